@@ -0,0 +1,44 @@
+/******************************************************************************
+ *
+ * Linker Command file for the RTOS on the Texas Instruments TM4C123GH6PM
+ *
+ * Derived from the default TivaWare linker command file. SRAM is split at
+ * REGION_0_ADDR (include/mm.h): the kernel's .data, .bss and the main stack
+ * must fit in the 4 KiB os area below it, the heap the mpu hands out to tasks
+ * starts there. The link fails with a placement error if the os area
+ * overflows, instead of task stacks overwriting kernel data at run time.
+ *
+ *****************************************************************************/
+
+--retain=g_pfnVectors
+
+MEMORY
+{
+    FLASH (RX) : origin = 0x00000000, length = 0x00040000
+    SRAM_OS (RWX) : origin = 0x20000000, length = 0x00001000
+    SRAM_HEAP (RWX) : origin = 0x20001000, length = 0x00007000
+}
+
+/* The following command line options are set as part of the CCS project.    */
+/* --heap_size=0                                                              */
+/* --stack_size=512                                                           */
+
+/* Section allocation in memory */
+
+SECTIONS
+{
+    .intvecs:   > 0x00000000
+    .text   :   > FLASH
+    .const  :   > FLASH
+    .cinit  :   > FLASH
+    .pinit  :   > FLASH
+    .init_array : > FLASH
+
+    .data   :   > SRAM_OS
+    .bss    :   > SRAM_OS
+    .sysmem :   > SRAM_OS
+    .stack  :   > SRAM_OS
+    .heap   :   > SRAM_HEAP
+}
+
+__STACK_TOP = __stack + 512;
@@ -17,6 +17,8 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "ring.h"
+#include "mm.h"
 
 //-----------------------------------------------------------------------------
 // RTOS Defines and Kernel Variables
@@ -26,20 +28,55 @@
 typedef void (*_fn)();
 
 // mutex
-#define MAX_MUTEXES 1
-#define MAX_MUTEX_QUEUE_SIZE 2
+#define MAX_MUTEXES 2
 #define resource 0
+#define benchMutex 1 // uncontended lock cost, only bench MUTEX uses it
+
+// fast mutex, lock and unlock stay in user mode unless another task holds it
+#define MAX_FAST_MUTEXES 8 // fills the 32 byte mpu region every task can write
+#define benchFast 0
 
 // semaphore
-#define MAX_SEMAPHORES 3
-#define MAX_SEMAPHORE_QUEUE_SIZE 2
-#define keyPressed 0
-#define keyReleased 1
-#define flashReq 2
+#define MAX_SEMAPHORES 1
+#define flashReq 0
+#define BENCH_SEMAPHORES 2 // after the app's, bench PINGPONG sets them up for each run
+#define benchPing MAX_SEMAPHORES
+#define benchPong (MAX_SEMAPHORES + 1)
+
+// condition variable
+#define MAX_CONDS 1
+
+// reader-writer lock
+#define MAX_RWLOCKS 1 // at most 8, tcb.readLocks has a bit per lock
+
+// event flags
+#define MAX_EVENTS 1
+#define keyEvents 0
+#define KEY_PRESSED  0x00000001 // set by readKeys, debounce waits for it
+#define KEY_RELEASED 0x00000002 // set by debounce, readKeys waits for it
+
+// ring buffers a blocked consumer can be woken on
+#define MAX_RINGS 4
+
+// message queue
+#define MAX_QUEUES 2
+#define MAX_QUEUE_MESSAGES 4
+#define MAX_MESSAGE_SIZE 16 // bytes copied by send(), sendBuffer() hands over the whole buffer
 
 // tasks
 #define MAX_TASKS 12
+#define INVALID_TASK 0xFF
 #define PS_REFRESH_TIME 1
+#define DEFAULT_QUANTUM 1 // ticks
+#define KEEP_PRIORITY 0xFF
+#define IDLE_TASK 0 // first thread created, the scheduler falls back to it so it can't be stopped
+#define NO_HEAP_QUOTA 0xFFFF // heap quota bigger than the whole heap
+#define STACK_GUARD 0 // 1 leaves an inaccessible subregion below each stack so an overflow faults, costs 512 B or 1 KiB per task
+
+// scheduler modes
+#define SCHED_RR    0
+#define SCHED_PRIO  1
+#define SCHED_EDF   2
 
 // task states
 #define STATE_INVALID           0 // no task
@@ -48,6 +85,21 @@ typedef void (*_fn)();
 #define STATE_DELAYED           3 // has run, but now awaiting timer
 #define STATE_BLOCKED_MUTEX     4 // has run, but now blocked by semaphore
 #define STATE_BLOCKED_SEMAPHORE 5 // has run, but now blocked by semaphore
+#define STATE_BLOCKED_QUEUE     6 // has run, but now blocked sending to a full or receiving from an empty queue
+#define STATE_BLOCKED_EVENT     7 // has run, but now waiting for event flags
+#define STATE_BLOCKED_RING      8 // has run, but now waiting for an isr to fill a ring buffer
+#define STATE_BLOCKED_NOTIFY    9 // has run, but now waiting for a notification
+#define STATE_BLOCKED_FAST      10 // has run, but now blocked by a contended fast mutex
+#define STATE_BLOCKED_READ      11 // has run, but now waiting to read a reader-writer lock
+#define STATE_BLOCKED_WRITE     12 // has run, but now waiting to write a reader-writer lock
+#define STATE_BLOCKED_COND      13 // has run, but now waiting for a condition variable to be signaled
+
+// blocking calls with a timeout
+#define NO_WAIT         0          // return right away instead of blocking
+#define WAIT_FOREVER    0xFFFFFFFF
+#define IPC_OK          0
+#define IPC_TIMEOUT     1          // gave up after the timeout
+#define IPC_INVALID     2          // bad object, size or buffer
 
 //sv calls
 #define SVC_START           0x00
@@ -69,16 +121,52 @@ typedef void (*_fn)();
 #define SVC_RESTARTTHREAD   0x10
 #define SVC_SETPRIORITY     0x11
 #define SVC_KILL            0x12
+#define SVC_BENCH           0x13
+#define SVC_TICKLESS        0x14
+#define SVC_PERIOD          0x15
+#define SVC_SEND            0x16
+#define SVC_SENDBUFFER      0x17
+#define SVC_RECEIVE         0x18
+#define SVC_SETEVENTS       0x19
+#define SVC_CLEAREVENTS     0x1A
+#define SVC_WAITEVENTS      0x1B
+#define SVC_LOCKTIMEOUT     0x1C
+#define SVC_WAITTIMEOUT     0x1D
+#define SVC_OPENRING        0x1E
+#define SVC_RINGWAIT        0x1F
+#define SVC_NOTIFY          0x20
+#define SVC_NOTIFYWAIT      0x21
+#define SVC_FASTWAIT        0x22
+#define SVC_FASTWAKE        0x23
+#define SVC_READLOCK        0x24
+#define SVC_READUNLOCK      0x25
+#define SVC_WRITELOCK       0x26
+#define SVC_WRITEUNLOCK     0x27
+#define SVC_CONDWAIT        0x28
+#define SVC_CONDSIGNAL      0x29
+#define SVC_CONDBROADCAST   0x2A
+#define SVC_POOLALLOC       0x2B
+#define SVC_POOLFREE        0x2C
+#define SVC_FREE            0x2D
+#define SVC_TRYMALLOC       0x2E
 
 #define SVC_REBOOT          0xFF
 
+// wait list, tasks blocked on an object linked through their tcb
+// highest currentPriority first, equal priorities in arrival order
+typedef struct _waitList {
+    uint8_t head;                  // next task to release, INVALID_TASK if none
+    uint8_t size;
+} waitList;
+
 // mutex
 #define INVALID_MUTEX 0xFF
+#define NO_CEILING 0xFF //plain mutex, otherwise the owner runs at the ceiling priority while holding it
 typedef struct _mutex {
     bool lock;
-    uint8_t queueSize;
-    uint8_t processQueue[MAX_MUTEX_QUEUE_SIZE];
+    waitList waiters;
     uint8_t lockedBy;
+    uint8_t ceiling;
 } mutex;
 mutex mutexes[MAX_MUTEXES];
 
@@ -86,10 +174,64 @@ mutex mutexes[MAX_MUTEXES];
 #define INVALID_SEMAPHORE 0xFF
 typedef struct _semaphore {
     uint8_t count;
-    uint8_t queueSize;
-    uint8_t processQueue[MAX_SEMAPHORE_QUEUE_SIZE];
+    waitList waiters;
 } semaphore;
-semaphore semaphores[MAX_SEMAPHORES];
+semaphore semaphores[MAX_SEMAPHORES + BENCH_SEMAPHORES];
+
+// message queue
+// waiters are receivers while the queue is empty and senders while it is full
+#define INVALID_QUEUE 0xFF
+#define MSG_COPY 0
+#define MSG_ZERO_COPY 1 // buffer is a malloc_ block, ownership and mpu access move to the receiver
+typedef struct _message {
+    uint8_t flags;
+    uint8_t sender;                // task index
+    uint16_t size;                 // bytes
+    void* buffer;                  // zero copy block, NULL for copied messages or if the sender died before delivery
+    uint8_t data[MAX_MESSAGE_SIZE];
+} message;
+typedef struct _msgQueue {
+    uint8_t head;                  // oldest message
+    uint8_t count;
+    message slots[MAX_QUEUE_MESSAGES];
+    waitList waiters;
+} msgQueue;
+msgQueue queues[MAX_QUEUES];
+
+// direct to task notification, how notify() combines value with the target's notification value
+#define NOTIFY_SET_BITS  0
+#define NOTIFY_INCREMENT 1 // value is ignored
+#define NOTIFY_OVERWRITE 2
+
+// event flags
+// waitEvents mode, EVENT_CLEAR can be or'd with either
+#define INVALID_EVENT 0xFF
+#define EVENT_ANY   0x00 // any bit of the mask
+#define EVENT_ALL   0x01 // every bit of the mask
+#define EVENT_CLEAR 0x02 // clear the bits that satisfied the wait
+typedef struct _eventFlags {
+    uint32_t flags;
+    waitList waiters;
+} eventFlags;
+eventFlags events[MAX_EVENTS];
+
+// reader-writer lock, any number of readers or one writer
+// a waiting writer keeps new readers out, so readers can't starve it
+#define INVALID_RWLOCK 0xFF
+typedef struct _rwLock {
+    uint8_t readers;               // tasks holding the lock for reading
+    uint8_t writer;                // task holding the lock for writing, INVALID_TASK if none
+    waitList readWaiters;
+    waitList writeWaiters;
+} rwLock;
+rwLock rwLocks[MAX_RWLOCKS];
+
+// condition variable, a signaled waiter moves straight to the wait list of its mutex
+#define INVALID_COND 0xFF
+typedef struct _condVar {
+    waitList waiters;
+} condVar;
+condVar conds[MAX_CONDS];
 
 
 //ps SVC will write to this struct then return it back to caller
@@ -101,22 +243,102 @@ typedef struct _psInfo {
     uint32_t runtime; //ticks
     uint8_t state; //if blocked mutex -> mutex, else if blocked semaphore -> semaphore
     uint8_t mutex_or_sem;
+    uint32_t misses; //periodic jobs that missed their deadline
+    uint32_t quantum; //ticks
+    uint16_t stackSize; //bytes
+    uint16_t stackPeak; //deepest the stack has been since create/restart, bytes
 } psInfo;
 
+//wait lists are copied out in release order
 typedef struct _ipcsInfo {
     mutex mutexes[MAX_MUTEXES];
+    uint8_t mutexWaiters[MAX_MUTEXES][MAX_TASKS];
     semaphore semaphores[MAX_SEMAPHORES];
+    uint8_t semaphoreWaiters[MAX_SEMAPHORES][MAX_TASKS];
+    uint8_t queueCount[MAX_QUEUES];
+    uint8_t queueSize[MAX_QUEUES];
+    uint8_t queueWaiters[MAX_QUEUES][MAX_TASKS];
+    eventFlags events[MAX_EVENTS];
+    uint8_t eventWaiters[MAX_EVENTS][MAX_TASKS];
+    rwLock rwLocks[MAX_RWLOCKS];
+    uint8_t rwReaders[MAX_RWLOCKS][MAX_TASKS];
+    uint8_t rwReadWaiters[MAX_RWLOCKS][MAX_TASKS];
+    uint8_t rwWriteWaiters[MAX_RWLOCKS][MAX_TASKS];
+    condVar conds[MAX_CONDS];
+    uint8_t condWaiters[MAX_CONDS][MAX_TASKS];
+    uint8_t condMutex[MAX_CONDS][MAX_TASKS];
     char nameArr[MAX_TASKS][16];
 } ipcsInfo;
 
-typedef struct _memInfo {//maybe add owner index later
+typedef struct _allocInfo {//maybe add owner index later
     char ownerName[16];
     uint8_t valid;
     void* baseAdd;
     uint32_t size;
-    uint32_t usage;
+    uint8_t stack; //block is its owner's stack
+    uint16_t guard; //bytes at the bottom of a stack block the task can't touch
+    uint32_t usage; //stack high-water mark, per mille of size
+} allocInfo;
+
+typedef struct _poolInfo {
+    char ownerName[16];
+    uint8_t valid;
+    void* baseAdd;
+    uint16_t blockSize;
+    uint8_t blocks;
+    uint8_t used;
+    uint8_t peak;
+} poolInfo;
+
+// heap status returned by try_malloc_from_heap
+#define HEAP_OK          0
+#define HEAP_NO_MEMORY   1 // no free run of subregions big enough, or the alloc table is full
+#define HEAP_OVER_QUOTA  2 // the block would take the task past its quota
+#define HEAP_INVALID     3 // size was 0, or ptr is outside the caller's memory
+
+//heap use of a task from malloc_from_heap, received buffers and its pools, in bytes of whole subregions
+typedef struct _quotaInfo {
+    char name[16];
+    uint8_t valid;
+    uint16_t quota;
+    uint16_t used;
+    uint16_t peak;
+} quotaInfo;
+
+//meminfo SVC fills this struct
+typedef struct _memInfo {
+    allocInfo allocs[MAX_ALLOCS];
+    poolInfo pools[MAX_POOLS];
+    quotaInfo quotas[MAX_TASKS];
 } memInfo;
 
+//bench SVC runs benchmark n in the kernel and fills this struct for the shell
+#define BENCH_SCHED 0
+#define BENCH_PI 1             // runs the workload with pi off then on
+#define BENCH_BLOCKING 2
+#define BENCH_BLOCKING_RESET 3
+#define BENCH_PI_WINDOW 10000  // ms per pi setting
+#define BENCH_SWITCHES 4
+#define BENCH_CONTEXT 5
+#define BENCH_RING 6
+#define BENCH_LAP 7            // cycles since the previous lap, in after[0]
+#define BENCH_PINGPONG 8       // shell and a pong task, post/wait then notify/notifyWait
+#define BENCH_ROUND_TRIPS 1000
+#define BENCH_MUTEX 9          // uncontended lock/unlock, svc mutex then fast mutex
+#define BENCH_HEAP 10          // random malloc/free trace, previous search then heapFit
+#define BENCH_EXCLUSIVE 11     // caller runs above its peers at BENCH_PRIORITY in priority mode
+#define BENCH_EXCLUSIVE_END 12 // puts back its priority and the scheduler mode, stops the pong task
+#define BENCH_PONG 13          // starts the pong task at BENCH_PRIORITY, after[0] is false if it couldn't
+#define BENCH_PRIORITY 1       // above every demo task but Important, which only wakes once a second
+#define MAX_BENCH_ROWS 4
+typedef struct _benchInfo {
+    uint8_t rows;
+    char unit[8];                  // unit of the before/after columns
+    char label[MAX_BENCH_ROWS][16];
+    uint32_t before[MAX_BENCH_ROWS]; // previous implementation or budget
+    uint32_t after[MAX_BENCH_ROWS];  // current implementation
+} benchInfo;
+
 //-----------------------------------------------------------------------------
 // External Functions
 //-----------------------------------------------------------------------------
@@ -126,9 +348,11 @@ extern void setPsp(void* addr); //set the address of the SP, can only be done in
 extern uint32_t* getPsp();
 extern uint32_t* getMsp();
 extern void setCtrl(uint32_t mask);
-extern void pushR4_R11();
-extern void popR11_R4();
 extern uint32_t getR0();
+extern uint32_t countLeadingZeros(uint32_t value);
+extern void atomicOr(volatile uint32_t* addr, uint32_t bits);
+extern uint32_t atomicExchange(volatile uint32_t* addr, uint32_t value);
+extern uint32_t atomicCompareExchange(volatile uint32_t* addr, uint32_t expected, uint32_t value);
 
 //-----------------------------------------------------------------------------
 // Subroutines
@@ -136,27 +360,61 @@ extern uint32_t getR0();
 
 uint32_t getCurrentTask();
 uint32_t getCurrentPid();
+bool inStackGuard(uint32_t addr);
 uint32_t getSysTime();
-bool initMutex(uint8_t mutex);
+bool initMutex(uint8_t mutex, uint8_t ceiling);
 bool initSemaphore(uint8_t semaphore, uint8_t count);
+bool initEvents(uint8_t event, uint32_t flags);
+bool initRwLock(uint8_t rwLock);
 void initRtos(void);
 void startRtos(void);
-bool createThread(_fn fn, const char name[], uint8_t priority, uint32_t stackBytes);
+bool createThread(_fn fn, const char name[], uint8_t priority, uint32_t stackBytes, uint32_t quantum, uint32_t heapQuota);
+bool createPeriodicThread(_fn fn, const char name[], uint8_t priority, uint32_t stackBytes, uint32_t period, uint32_t deadline, uint32_t wcet, uint32_t heapQuota);
 int32_t kill_proc(uint32_t pid);
 uint32_t restartThread(_fn fn);
 uint32_t stopThread(_fn fn);
 
-void setThreadPriority(_fn fn, uint8_t priority);
+void setThreadPriority(_fn fn, uint8_t priority, uint32_t quantum);
+void runBench(benchInfo* info, uint8_t bench);
 
 
 void yield(void);
 void sleep(uint32_t tick);
-void lock(int8_t mutex);
+void waitNextPeriod(void);
+uint8_t lock(int8_t mutex);
 void unlock(int8_t mutex);
 void wait(int8_t semaphore);
 void post(int8_t semaphore);
+uint8_t lock_timeout(int8_t mutex, uint32_t timeout);
+uint8_t wait_timeout(int8_t semaphore, uint32_t timeout);
+void fastLock(uint8_t mutex);
+void fastUnlock(uint8_t mutex);
+uint8_t readLock(uint8_t rwLock, uint32_t timeout);
+void readUnlock(uint8_t rwLock);
+uint8_t writeLock(uint8_t rwLock, uint32_t timeout);
+void writeUnlock(uint8_t rwLock);
+uint8_t cond_wait(uint8_t cond, int8_t mutex);
+void cond_signal(uint8_t cond);
+void cond_broadcast(uint8_t cond);
+void* malloc_from_heap(uint32_t size);
+uint8_t try_malloc_from_heap(uint32_t size, void** ptr);
+bool free_from_heap(void* ptr);
+void* malloc_from_pool(uint32_t size);
+bool free_to_pool(void* ptr);
+uint8_t send(uint8_t queue, const void* data, uint32_t size, uint32_t timeout);
+uint8_t sendBuffer(uint8_t queue, void* buffer, uint32_t size, uint32_t timeout);
+uint8_t receive(uint8_t queue, message* msg, uint32_t timeout);
+void setEvents(uint8_t event, uint32_t bits);
+void clearEvents(uint8_t event, uint32_t bits);
+uint32_t waitEvents(uint8_t event, uint32_t bits, uint8_t mode, uint32_t timeout);
+bool openRing(ringBuffer* r);
+uint8_t ringWait(ringBuffer* r, uint32_t timeout);
+void ringSignalFromIsr(ringBuffer* r);
+bool notify(_fn fn, uint32_t value, uint8_t action);
+uint32_t notifyWait(uint32_t clearBits, uint32_t timeout);
 
 void sysTickIsr(void);
+uint64_t taskSwitch(uint32_t* sp, uint32_t excReturn);
 void pendsvIsr(void);
 void svCallIsr(void);
 
@@ -4,8 +4,9 @@
 #include <stdint.h>
 
 #define REGION_FLASH_ADDR 0x00000000
+#define REGION_FLASH_SIZE 0x00040000
 #define REGION_OS_ADDR 0x20000000
-#define REGION_0_ADDR 0x20001000
+#define REGION_0_ADDR 0x20001000 // kernel data and the main stack end below this, core/tm4c123gh6pm.cmd fails the link otherwise
 #define REGION_1_ADDR 0x20002000
 #define REGION_2_ADDR 0x20003000
 #define REGION_3_ADDR 0x20004000
@@ -19,32 +20,67 @@
 #define _kB 1024
 #define _MB 1024*1024
 #define _GB 1024*1024*1024
-#define MAX_ALLOCS 12
+#define MAX_ALLOCS 40        // one per subregion is enough for any mix, slots are uint8_t so at most 254
+#define MAX_ALLOC_OWNERS 16  // owners are task indexes, keep >= MAX_TASKS
+#define INVALID_ALLOC 0xFF
+
+// block pools, small allocations share a 512 B subregion cut into equal blocks
+#define POOL_CLASSES 4      // 16, 32, 64 and 128 byte blocks
+#define POOL_MIN_BLOCK 16
+#define POOL_BYTES 512      // at most 32 blocks, one bit each in freeMask
+#define MAX_POOLS 8
+#define INVALID_POOL 0xFF
 
 typedef struct {
     void* ptr;
-    uint32_t size;
-    uint32_t owner;
+    uint16_t size;      // heap is 28 KiB, kept small so the table fits in os memory
+    uint8_t owner;
     uint8_t valid;
+    uint8_t prev;       // owner's chain while valid
+    uint8_t next;       // owner's chain while valid, free slot list otherwise
 } alloc_entry;
 
+typedef struct {
+    uint8_t* base;      // subregion the blocks are carved from, NULL if the pool is unused
+    uint32_t freeMask;  // bit 31-n set while block n is free
+    uint16_t blockSize;
+    uint8_t used;       // blocks handed out
+    uint8_t peak;
+    uint32_t owner;
+} block_pool;
+
 uint64_t inUse; //64 bit field, use 39:0 for the 8*5 subregions
 alloc_entry allocTable[MAX_ALLOCS];
+block_pool pools[MAX_POOLS];
 
 void setRegionAddr(uint32_t region, void* addr);
 void initMpu();
 void* calcSubregionAddr(uint32_t g_sr);
 uint32_t getSubregionFromAddr(void* addr);
+void initAllocTable(void);
 void initEntry(alloc_entry* entry, uint32_t size, void* ptr, uint32_t owner);
-void push_entry(alloc_entry entry);
+uint8_t push_entry(alloc_entry entry);
 void delete_entry(uint32_t idx);
+alloc_entry* findAlloc(void* ptr);
+void setAllocOwner(void* ptr, uint32_t owner);
+int32_t zoneFit(uint32_t free, uint32_t n, uint32_t count);
+int32_t heapFit(uint64_t map, uint32_t bytes, uint32_t guard, uint32_t* size);
 void* malloc_(uint32_t bytes);
+void* mallocGuarded(uint32_t bytes, uint32_t* guard);
 void free_to_heap(void* ptr);
+void freeOwned(uint32_t owner);
+uint8_t poolClass(uint32_t bytes);
+uint8_t createPool(uint32_t blockSize, uint32_t owner);
+void deletePool(uint8_t pool);
+void* poolAlloc(uint8_t pool);
+uint8_t poolFree(void* ptr, uint32_t owner);
 void allowFlashAccess(void);
 void allowPeripheralAccess(void);
 void setupSramAccess(void);
+void allowSharedAccess(void* base, uint32_t size_in_bytes);
 uint64_t createNoSramAccessMask(void);
 void applySramAccessMask();
 void addSramAccessWindow(uint64_t* srdBitMask, uint32_t* baseAdd, uint32_t size_in_bytes);
+void removeSramAccessWindow(uint64_t* srdBitMask, uint32_t* baseAdd, uint32_t size_in_bytes);
 
 #endif
@@ -0,0 +1,44 @@
+// Ring Buffer Library
+// Giancarlo Perez
+
+//-----------------------------------------------------------------------------
+// Hardware Target
+//-----------------------------------------------------------------------------
+
+// Target Platform: EK-TM4C123GXL
+// Target uC:       TM4C123GH6PM
+// System Clock:    -
+
+// Hardware configuration: -
+
+//-----------------------------------------------------------------------------
+// Device includes, defines, and assembler directives
+//-----------------------------------------------------------------------------
+
+#ifndef RING_H_
+#define RING_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// single producer (usually an isr) / single consumer (a task) byte ring
+// head and tail run freely and are each stored by one side only, so neither side needs a lock
+#define INVALID_RING 0xFF
+typedef struct _ringBuffer {
+    volatile uint32_t head;        // bytes written so far, producer only
+    volatile uint32_t tail;        // bytes read so far, consumer only
+    uint32_t mask;                 // size - 1
+    uint8_t* data;
+    uint8_t id;                    // kernel slot from openRing(), lets the producer wake a blocked consumer
+} ringBuffer;
+
+//-----------------------------------------------------------------------------
+// Subroutines
+//-----------------------------------------------------------------------------
+
+bool initRing(ringBuffer* r, uint8_t* data, uint32_t size);
+uint32_t ringCount(ringBuffer* r);
+uint32_t ringPut(ringBuffer* r, const uint8_t* src, uint32_t n);
+uint32_t ringGet(ringBuffer* r, uint8_t* dst, uint32_t n);
+
+#endif
@@ -10,11 +10,14 @@ void ps();
 void ipcs();
 void kill(uint32_t pid);
 void pkill(const char name[]);
-void sched(uint8_t prio_on);
+void sched(uint8_t mode);
 void pi(uint8_t on);
 void preempt(uint8_t on);
+void tickless(uint8_t on);
+void quantum(const char name[], uint32_t ticks);
 uint32_t pidof(const char name[]);
 void meminfo();
+void bench(uint8_t n);
 void reboot();
 void shell();
 
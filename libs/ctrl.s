@@ -4,9 +4,12 @@
 	.global getMsp
 	.global setCtrl
 	.global clrCtrl
-	.global pushR4_R11
-	.global popR11_R4
 	.global getR0
+	.global countLeadingZeros
+	.global countTrailingZeros
+	.global atomicOr
+	.global atomicExchange
+	.global atomicCompareExchange
 
 .thumb
 .const
@@ -47,34 +50,44 @@ clrCtrl:
 		ISB
 		BX LR
 
-pushR4_R11:
-		MRS R0, PSP
-		STR R4, [R0, #-4]
-		STR R5, [R0, #-8]
-		STR R6, [R0, #-12]
-		STR R7, [R0, #-16]
-		STR R8, [R0, #-20]
-		STR R9, [R0, #-24]
-		STR R10, [R0, #-28]
-		STR R11, [R0, #-32]
-		SUB R0, R0, #32
-		MSR PSP, R0
+getR0:
+	BX LR
+
+countLeadingZeros:
+		CLZ R0, R0
 		BX LR
 
-popR11_R4:
-		MRS R0, PSP
-		LDR R11, [R0]
-		LDR R10, [R0, #4]
-		LDR R9, [R0, #8]
-		LDR R8, [R0, #12]
-		LDR R7, [R0, #16]
-		LDR R6, [R0, #20]
-		LDR R5, [R0, #24]
-		LDR R4, [R0, #28]
-		ADD R0, R0, #32
-		MSR PSP, R0
+countTrailingZeros:
+		RBIT R0, R0
+		CLZ R0, R0
 		BX LR
 
-getR0:
-	BX LR
+atomicOr:
+		LDREX R2, [R0]
+		ORR R2, R2, R1
+		STREX R3, R2, [R0]
+		CMP R3, #0
+		BNE atomicOr ;; an exception in between cleared the monitor, retry
+		BX LR
 
+atomicExchange:
+		LDREX R2, [R0]
+		STREX R3, R1, [R0]
+		CMP R3, #0
+		BNE atomicExchange
+		MOV R0, R2
+		BX LR
+
+atomicCompareExchange:
+		LDREX R3, [R0]
+		CMP R3, R1
+		BNE compareFailed
+		STREX R12, R2, [R0]
+		CMP R12, #0
+		BNE atomicCompareExchange
+		MOV R0, R3
+		BX LR
+compareFailed:
+		CLREX ;; drop the reservation, the value seen is returned
+		MOV R0, R3
+		BX LR
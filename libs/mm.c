@@ -3,7 +3,13 @@
 #include "tm4c123gh6pm.h"
 #include "mm.h"
 
-uint32_t n_allocs = 0;
+extern uint32_t countLeadingZeros(uint32_t value);
+extern uint32_t countTrailingZeros(uint32_t value);
+
+uint8_t freeSlot = INVALID_ALLOC;          //first unused allocTable slot, linked through next
+uint8_t ownerHead[MAX_ALLOC_OWNERS];      //first slot of each owner's chain
+uint8_t subregionSlot[40];                //slot of the allocation that starts at each subregion
+uint8_t poolOfSubregion[40]; //pool carved from each subregion, valid while pools[].base points at it
 
 void* calcSubregionAddr(uint32_t g_sr) {
     void* addr = (g_sr < 24) ? (REGION_0_ADDR + g_sr * 512) : (REGION_3_ADDR + (g_sr - 24) * 1024); //beginning of heap addr
@@ -24,132 +30,271 @@ uint32_t getSubregionFromAddr(void* addr) {
     return sr;
 }
 
+void initAllocTable(void) {
+    uint32_t i;
+    for (i = 0; i < MAX_ALLOCS; i++) {
+        allocTable[i].valid = 0;
+        allocTable[i].next = (i + 1 < MAX_ALLOCS) ? i + 1 : INVALID_ALLOC;
+    }
+    freeSlot = 0;
+    for (i = 0; i < MAX_ALLOC_OWNERS; i++) {
+        ownerHead[i] = INVALID_ALLOC;
+    }
+}
+
 void initEntry(alloc_entry* entry, uint32_t size, void* ptr, uint32_t owner) {
     entry->size = size;
     entry->ptr = ptr;
     entry->owner = owner;
 }
 
-void push_entry(alloc_entry entry) {
-    alloc_entry* cpy = &allocTable[n_allocs++];
-    cpy->owner = entry.owner;
-    cpy->ptr = entry.ptr;
-    cpy->size = entry.size;
-    cpy->valid = 1;
+void linkOwner(uint8_t slot) {
+    uint32_t owner = allocTable[slot].owner;
+    allocTable[slot].prev = INVALID_ALLOC;
+    allocTable[slot].next = ownerHead[owner];
+    if (ownerHead[owner] != INVALID_ALLOC) {
+        allocTable[ownerHead[owner]].prev = slot;
+    }
+    ownerHead[owner] = slot;
+}
+
+void unlinkOwner(uint8_t slot) {
+    alloc_entry* entry = &allocTable[slot];
+    if (entry->prev != INVALID_ALLOC) {
+        allocTable[entry->prev].next = entry->next;
+    }
+    else {
+        ownerHead[entry->owner] = entry->next;
+    }
+    if (entry->next != INVALID_ALLOC) {
+        allocTable[entry->next].prev = entry->prev;
+    }
+}
+
+//takes a slot off the free list, returns it or INVALID_ALLOC if the table is full
+uint8_t push_entry(alloc_entry entry) {
+    uint8_t slot = freeSlot;
+    if (slot != INVALID_ALLOC) {
+        freeSlot = allocTable[slot].next;
+        initEntry(&allocTable[slot], entry.size, entry.ptr, entry.owner);
+        allocTable[slot].valid = 1;
+        linkOwner(slot);
+        subregionSlot[getSubregionFromAddr(entry.ptr)] = slot;
+    }
+    return slot;
 }
 
 void delete_entry(uint32_t idx) {
-    if (idx < n_allocs) {
-        uint32_t i;
-        for (i = idx; i < n_allocs-1; i++) {
-            initEntry(&allocTable[i], allocTable[i+1].size, allocTable[i+1].ptr, allocTable[i+1].owner);
-            allocTable[i+1].valid = 1;
-        }
-        initEntry(&allocTable[n_allocs-1], 0, 0, 0);//set the last one to all 0
-        allocTable[n_allocs-1].valid = 0;
-        n_allocs--;
+    if (idx < MAX_ALLOCS && allocTable[idx].valid) {
+        unlinkOwner(idx);
+        initEntry(&allocTable[idx], 0, 0, 0);
+        allocTable[idx].valid = 0;
+        allocTable[idx].next = freeSlot;
+        freeSlot = idx;
     }
 }
 
-void* malloc_(uint32_t bytes) {
-    uint16_t x = bytes <= 512 ? 512 : 1024;
-    uint32_t size = (bytes + (x - ((bytes - 1) % x) - 1)); //rounds bytes up to nearest multiple of 512 if bytes <= 512, else multiple of 1024
-    uint32_t gsr;
-    //uint32_t sr_mask;
-    uint32_t success = 0;
-    //alloc_entry* newEntry = &allocTable[n_allocs];
-    alloc_entry newEntry;
-    uint32_t contig = 0;
-    for (gsr = 0; gsr < 40; gsr++) {
-        if (!success) {
-            if (~inUse & (1ULL << gsr)) { // if the bit at region R and subregion SR is not set, it is not in use
-                contig++;
-                //uint32_t g_sr = r * 8 + sr; //global subregion, from 0 to 39
-                uint32_t sr_size = gsr < 24 ? 512 : 1024;
-                //if we allocating 512B, look for a 512 subregion
-                //if we are allocating >512B look for a 1024*N subregion
-                //size is the N bytes rounded, what we are looking for
-                if (size > sr_size) {
-                    //asking for 1024, found 512 a > b
-                    //ignore, malloc won't fit in subregion
-                    //asking for 2048, found 1024 a > b && a > 1024
-                    if (sr_size == 1024) {
-                        //split up into blocks
-                        uint32_t n_sr = size / 1024; //should already be in multiples of 1024
-                        //find starting subregion?
-                        //subregion minus contig minus 1?
-                        if (contig == n_sr) {
-                            uint32_t c;
-                            //uint32_t sr_start = sr - contig + 1;
-                            uint32_t gsr_start = gsr - contig + 1;
-                            for (c = gsr_start; c <= gsr; c++) {
-                                inUse |= (1ULL << c); //set c'th subregion to in use.
-                            }
-                            void* regionaddr = calcSubregionAddr(gsr_start); //get address of beginning of contiguous memory.
-                            initEntry(&newEntry, size, regionaddr, 0);
-                            success = 1;
-                        }
-                    }
-
-                }
-                else if (size == sr_size) { //if region directly matches what we are looking for,
-                    //asking for 512, found 512 a == b
-                    //asking for 1024 found 1024 a == b
-                    //claim this subregion
-                    //inUse[r] |= (1 << sr);
-                    inUse |= (1ULL << gsr);
-                    void* regionaddr = calcSubregionAddr(gsr);
-                    initEntry(&newEntry, size, regionaddr, 0);
-                    success = 1;
-                }
-                else if (size < sr_size) {
-                    //asking for 512, found 1024 a < b
-                    //ignore, should only go to 512
-                    //asking for 1024, found anything higher is impossible
-                }
-            }
-            else {
-                //if in use, reset the contiguous count
-                contig = 0;
-            }
-        }
+//entry of the allocation starting at ptr, NULL if there is none
+alloc_entry* findAlloc(void* ptr) {
+    alloc_entry* entry;
+    if ((uint32_t)ptr < REGION_0_ADDR || (uint32_t)ptr >= REGION_4_ADDR_TOP) {
+        return NULL;
+    }
+    entry = &allocTable[subregionSlot[getSubregionFromAddr(ptr)]];
+    return (entry->valid && entry->ptr == ptr) ? entry : NULL;
+}
+
+void setAllocOwner(void* ptr, uint32_t owner) {
+    alloc_entry* entry = findAlloc(ptr);
+    if (entry != NULL) {
+        unlinkOwner(entry - allocTable);
+        entry->owner = owner;
+        linkOwner(entry - allocTable);
+    }
+}
+
+//lowest start of n free subregions in a zone's free bits, preferring a start aligned to n rounded up
+//to a power of 2 like a buddy block, so freed neighbours merge back into bigger runs; -1 if none
+int32_t zoneFit(uint32_t free, uint32_t n, uint32_t count) {
+    static const uint32_t buddyStarts[6] = {0xFFFFFFFF, 0x55555555, 0x11111111, 0x01010101, 0x00010001, 0x00000001};
+    uint32_t starts = free;
+    uint32_t run = 1;
+    uint32_t step, order;
+    if (n == 0 || n > count) {
+        return -1;
     }
-    if (success) {
-        newEntry.owner = getCurrentTask();
-        push_entry(newEntry);
-        //addSramAccessWindow(&srdMask, newEntry.ptr, newEntry.size);
-        //applySramAccessMask(srdMask);
-        //how do we get srd Mask here? maybe read directly from reg but idk if we can
-        //CALL OUTSIDE FN
-        return newEntry.ptr;
-        //n_allocs++:
+    //bit i survives while subregions i to i+run-1 are all free, run doubles each pass
+    while (run < n && starts != 0) {
+        step = (n - run < run) ? n - run : run;
+        starts &= starts >> step;
+        run += step;
     }
-    else {
+    if (starts == 0) {
+        return -1;
+    }
+    for (order = 0; (1U << order) < n; order++);
+    if (starts & buddyStarts[order]) {
+        starts &= buddyStarts[order];
+    }
+    return countTrailingZeros(starts);
+}
+
+//first subregion of a free run for bytes plus guard extra subregions in map, -1 if none, size gets the bytes the run covers
+//tries the zone that rounds bytes up the least first, then the other one
+int32_t heapFit(uint64_t map, uint32_t bytes, uint32_t guard, uint32_t* size) {
+    uint32_t n512 = (bytes + 511) / 512 + guard;
+    uint32_t n1k = (bytes + 1023) / 1024 + guard;
+    uint32_t free512 = ~(uint32_t)map & 0x00FFFFFF;
+    uint32_t free1k = ~(uint32_t)(map >> 24) & 0x0000FFFF;
+    uint8_t small = (n512 * 512 < n1k * 1024);
+    int32_t sr512 = zoneFit(free512, n512, 24);
+    int32_t sr1k = zoneFit(free1k, n1k, 16);
+    if (sr1k >= 0) {
+        sr1k += 24;
+    }
+    if (sr512 < 0 || (sr1k >= 0 && !small)) {
+        *size = n1k * 1024;
+        return sr1k;
+    }
+    *size = n512 * 512;
+    return sr512;
+}
+
+//block of bytes with guard whole subregions below them, the block starts at the guard
+static void* heapAlloc(uint32_t bytes, uint32_t guard) {
+    uint32_t size, j;
+    int32_t gsr;
+    alloc_entry newEntry;
+    if (freeSlot == INVALID_ALLOC || bytes == 0) {
+        return NULL; //no slot to record it in
+    }
+    gsr = heapFit(inUse, bytes, guard, &size);
+    if (gsr < 0) {
         return NULL;
     }
+    for (j = gsr; j < gsr + size / (gsr < 24 ? 512 : 1024); j++) {
+        inUse |= (1ULL << j); //set j'th subregion to in use.
+    }
+    initEntry(&newEntry, size, calcSubregionAddr(gsr), getCurrentTask());
+    push_entry(newEntry);
+    return newEntry.ptr;
+}
+
+void* malloc_(uint32_t bytes) {
+    return heapAlloc(bytes, 0);
+}
+
+//stack block whose lowest subregion is left as a guard, guard gets its size since it depends on the zone
+void* mallocGuarded(uint32_t bytes, uint32_t* guard) {
+    void* ptr = heapAlloc(bytes, 1);
+    *guard = (ptr != NULL && getSubregionFromAddr(ptr) >= 24) ? 1024 : 512;
+    return ptr;
 }
 
 
 
 void free_to_heap(void* ptr) {
-    uint32_t i, j;
-    for (i = 0; i < MAX_ALLOCS; i++) {
-        alloc_entry entry = allocTable[i];
-        if (entry.valid) {
-            //check ownership?
-            if (entry.ptr == ptr) {
-                uint32_t gsr = getSubregionFromAddr(ptr);
-                uint32_t nsr = allocTable[i].size/(gsr < 24 ? 512 : 1024); //number of subregions the allocation spans
-                for (j = gsr; j < gsr + nsr; j++) {
-                    inUse &= ~(1ULL << j);
-                }
-                delete_entry(i); //delete entry from alloc table,
-            }
+    uint32_t j;
+    alloc_entry* entry = findAlloc(ptr);
+    if (entry != NULL) {
+        //ownership is checked by the caller, SVC_FREE only passes blocks owned by the current task
+        uint32_t gsr = getSubregionFromAddr(ptr);
+        uint32_t nsr = entry->size/(gsr < 24 ? 512 : 1024); //number of subregions the allocation spans
+        for (j = gsr; j < gsr + nsr; j++) {
+            inUse &= ~(1ULL << j);
+        }
+        delete_entry(entry - allocTable); //delete entry from alloc table,
+    }
+}
+
+//frees everything owner holds, walking only its own chain
+void freeOwned(uint32_t owner) {
+    while (ownerHead[owner] != INVALID_ALLOC) {
+        free_to_heap(allocTable[ownerHead[owner]].ptr);
+    }
+}
+
+//smallest block class that fits bytes, POOL_CLASSES if it needs a heap allocation
+uint8_t poolClass(uint32_t bytes) {
+    uint8_t c = 0;
+    while (c < POOL_CLASSES && ((uint32_t)POOL_MIN_BLOCK << c) < bytes) {
+        c++;
+    }
+    return c;
+}
+
+//takes a 512 B subregion for owner and marks every block free, returns INVALID_POOL if none is left
+uint8_t createPool(uint32_t blockSize, uint32_t owner) {
+    uint32_t i;
+    uint8_t p = INVALID_POOL;
+    for (i = 0; i < MAX_POOLS && p == INVALID_POOL; i++) {
+        if (pools[i].base == NULL) {
+            p = i;
         }
     }
-    //check if owned memory before freeing
-    //how?
+    if (p != INVALID_POOL) {
+        pools[p].base = malloc_(POOL_BYTES);
+        if (pools[p].base != NULL) {
+            pools[p].blockSize = blockSize;
+            pools[p].freeMask = 0xFFFFFFFF << (32 - POOL_BYTES / blockSize);
+            pools[p].used = 0;
+            pools[p].peak = 0;
+            pools[p].owner = owner;
+            poolOfSubregion[getSubregionFromAddr(pools[p].base)] = p;
+        }
+        else {
+            p = INVALID_POOL;
+        }
+    }
+    return p;
+}
+
+//gives the subregion back to the heap, outstanding blocks go with it
+void deletePool(uint8_t pool) {
+    free_to_heap(pools[pool].base);
+    pools[pool].base = NULL;
+}
+
+//first free block, NULL if the pool is full
+void* poolAlloc(uint8_t pool) {
+    block_pool* p = &pools[pool];
+    uint32_t n;
+    if (p->freeMask == 0) {
+        return NULL;
+    }
+    n = countLeadingZeros(p->freeMask);
+    p->freeMask &= ~(0x80000000 >> n);
+    p->used++;
+    if (p->used > p->peak) {
+        p->peak = p->used;
+    }
+    return p->base + n * p->blockSize;
+}
 
+//returns false unless ptr is the start of a block owner holds, so double and foreign frees are caught
+uint8_t poolFree(void* ptr, uint32_t owner) {
+    uint8_t* addr = ptr;
+    uint32_t sr, n;
+    block_pool* p;
+    if (addr < (uint8_t*)REGION_0_ADDR || addr >= (uint8_t*)REGION_4_ADDR_TOP) {
+        return 0;
+    }
+    sr = getSubregionFromAddr(addr);
+    if (poolOfSubregion[sr] >= MAX_POOLS) {
+        return 0;
+    }
+    p = &pools[poolOfSubregion[sr]];
+    if (p->base == NULL || addr < p->base || addr >= p->base + POOL_BYTES || p->owner != owner
+            || (addr - p->base) % p->blockSize != 0) {
+        return 0;
+    }
+    n = (addr - p->base) / p->blockSize;
+    if (p->freeMask & (0x80000000 >> n)) {
+        return 0;
+    }
+    p->freeMask |= 0x80000000 >> n;
+    p->used--;
+    return 1;
 }
 
 uint32_t log2(uint32_t v) {
@@ -290,6 +435,21 @@ void setupSramAccess(void) {
 }
 
 
+//region 7 opens one block of os memory to every task, base must be aligned to its power of 2 size (32 B min)
+void allowSharedAccess(void* base, uint32_t size_in_bytes) {
+    uint32_t N = log2(size_in_bytes);
+    NVIC_MPU_NUMBER_R = 7;
+    NVIC_MPU_BASE_R |= ((uint32_t)base & NVIC_MPU_BASE_ADDR_M);
+    NVIC_MPU_ATTR_R =
+            NVIC_MPU_ATTR_XN |
+            (0b011 << 24) |
+            NVIC_MPU_ATTR_SHAREABLE |
+            NVIC_MPU_ATTR_BUFFRABLE |
+            (N-1 << 1) |
+            NVIC_MPU_ATTR_ENABLE;
+}
+
+
 uint64_t createNoSramAccessMask(void) {
     uint64_t srdBitMask = 0x000000FFFFFFFFFF; //bits 39:0 are set since there are 40 subregions to set SRD
     return srdBitMask;
@@ -344,3 +504,15 @@ void addSramAccessWindow(uint64_t* srdBitMask, uint32_t* baseAdd, uint32_t size_
     //applySramAccessMask(*srdBitMask);
 }
 
+//opposite of addSramAccessWindow, used when a block changes owner
+void removeSramAccessWindow(uint64_t* srdBitMask, uint32_t* baseAdd, uint32_t size_in_bytes) {
+    uint32_t i = 0;
+    uint32_t N;
+    uint32_t sr = getSubregionFromAddr(baseAdd);
+    do {
+        N = (sr < 24) ? 512 : 1024;
+        *srdBitMask |= (1ULL << sr);
+        i += N;
+        sr++;
+    } while (i < size_in_bytes);
+}
@@ -0,0 +1,73 @@
+// Ring Buffer Library
+// Giancarlo Perez
+
+//-----------------------------------------------------------------------------
+// Hardware Target
+//-----------------------------------------------------------------------------
+
+// Target Platform: EK-TM4C123GXL
+// Target uC:       TM4C123GH6PM
+// System Clock:    -
+
+// Hardware configuration: -
+
+//-----------------------------------------------------------------------------
+// Device includes, defines, and assembler directives
+//-----------------------------------------------------------------------------
+
+#include "ring.h"
+
+//-----------------------------------------------------------------------------
+// Subroutines
+//-----------------------------------------------------------------------------
+
+// size has to be a power of 2 so the free running indexes wrap with a mask
+bool initRing(ringBuffer* r, uint8_t* data, uint32_t size)
+{
+    bool ok = (size != 0) && ((size & (size - 1)) == 0);
+    if (ok)
+    {
+        r->head = 0;
+        r->tail = 0;
+        r->mask = size - 1;
+        r->data = data;
+        r->id = INVALID_RING;
+    }
+    return ok;
+}
+
+uint32_t ringCount(ringBuffer* r)
+{
+    return r->head - r->tail;
+}
+
+// producer side, returns the bytes that fit
+uint32_t ringPut(ringBuffer* r, const uint8_t* src, uint32_t n)
+{
+    uint32_t head = r->head;
+    uint32_t space = (r->mask + 1) - (head - r->tail);
+    uint32_t i;
+    if (n > space)
+        n = space;
+    for (i = 0; i < n; i++)
+        r->data[(head + i) & r->mask] = src[i];
+    __asm(" DMB");                  // data is written before the head that publishes it
+    r->head = head + n;
+    return n;
+}
+
+// consumer side, returns the bytes read
+uint32_t ringGet(ringBuffer* r, uint8_t* dst, uint32_t n)
+{
+    uint32_t tail = r->tail;
+    uint32_t count = r->head - tail;
+    uint32_t i;
+    if (n > count)
+        n = count;
+    __asm(" DMB");                  // head is read before the data it published
+    for (i = 0; i < n; i++)
+        dst[i] = r->data[(tail + i) & r->mask];
+    __asm(" DMB");                  // data is read before the producer may reuse it
+    r->tail = tail + n;
+    return n;
+}
@@ -0,0 +1,67 @@
+; Context Switch
+; Giancarlo Perez
+
+;-----------------------------------------------------------------------------
+; Hardware Target
+;-----------------------------------------------------------------------------
+
+; Target Platform: EK-TM4C123GXL Evaluation Board
+; Target uC:       TM4C123GH6PM
+; System Clock:    40 MHz
+
+;-----------------------------------------------------------------------------
+; Device includes, defines, and assembler directives
+;-----------------------------------------------------------------------------
+
+   .def pendsvIsr
+   .ref taskSwitch
+   .ref switchCycles
+
+;-----------------------------------------------------------------------------
+; Register values and large immediate values
+;-----------------------------------------------------------------------------
+
+.thumb
+.const
+
+   .align 4
+DWT_CYCCNT:      .word 0xE0001004
+SWITCH_CYCLES:   .word switchCycles
+
+;-----------------------------------------------------------------------------
+; Subroutines
+;-----------------------------------------------------------------------------
+
+; Task stack after a switch out (high to low address):
+;   hardware frame (R0-R3, R12, LR, PC, xPSR, S0-S15 and FPSCR if the task used the fpu)
+;   S16-S31 (only if EXC_RETURN bit 4 is clear)
+;   R11-R4
+; EXC_RETURN is kept in the tcb, taskSwitch() saves and restores it.
+; switchCycles[0] is the last switch cost, switchCycles[1] the worst one.
+
+pendsvIsr:
+             LDR     R2, DWT_CYCCNT
+             LDR     R3, [R2]             ; start of the switch
+             MRS     R0, PSP
+             TST     LR, #0x10            ; bit 4 clear if the task has an fpu frame
+             IT      EQ
+             VSTMDBEQ R0!, {S16-S31}
+             STMDB   R0!, {R4-R11}
+             MOV     R4, R2               ; R4-R11 are saved, keep the counter in them across the call
+             MOV     R5, R3
+             MOV     R1, LR
+             BL      taskSwitch           ; R0 = next sp, R1 = next EXC_RETURN
+             LDR     R2, [R4]
+             SUB     R2, R2, R5
+             LDR     R3, SWITCH_CYCLES
+             STR     R2, [R3]             ; last switch
+             LDR     R12, [R3, #4]
+             CMP     R2, R12
+             IT      HI
+             STRHI   R2, [R3, #4]         ; worst switch
+             LDMIA   R0!, {R4-R11}
+             TST     R1, #0x10
+             IT      EQ
+             VLDMIAEQ R0!, {S16-S31}
+             MSR     PSP, R0
+             BX      R1
@@ -72,6 +72,19 @@ void mpuFaultIsr(void) {
     uint32_t faultStat = NVIC_FAULT_STAT_R;
     uint32_t* psp = getPsp();
     uint32_t* msp = getMsp();
+    //an access to the guard below the stack, or a frame pushed into it on exception entry, is an overflow
+    //the frame can't be trusted then, so skip the dump and stop the task before it writes anything else
+    if (((faultStat & NVIC_FAULT_STAT_MMARV) && inStackGuard(NVIC_MM_ADDR_R)) ||
+        ((faultStat & NVIC_FAULT_STAT_MSTKE) && inStackGuard((uint32_t)psp))) {
+        fput1hUart0("\nStack overflow in process 0x%p\n", pid);
+        NVIC_SYS_HND_CTRL_R &= ~NVIC_SYS_HND_CTRL_MEMP;
+        NVIC_FAULT_STAT_R = faultStat & (NVIC_FAULT_STAT_MMARV | NVIC_FAULT_STAT_MSTKE | NVIC_FAULT_STAT_DERR);
+        if (kill_proc(pid) != -1) {
+            fput1hUart0("Stopped process 0x%p\n\n>", pid);
+        }
+        NVIC_INT_CTRL_R |= NVIC_INT_CTRL_PEND_SV;
+        return;
+    }
     fput1hUart0("\nMPU fault in process %p\n", pid);
     putsUart0("------------------------------------\n");
     fput1hUart0("PSP:\t0x%p\n", (uint32_t)psp);
@@ -91,6 +104,7 @@ void mpuFaultIsr(void) {
     fput1hUart0("R12:\t0x%p\n", psp[4]);
     putsUart0("------------------------------------\n\n");
     NVIC_SYS_HND_CTRL_R &= ~NVIC_SYS_HND_CTRL_MEMP; //clear fault pending register
+    NVIC_FAULT_STAT_R = faultStat & (NVIC_FAULT_STAT_DERR | NVIC_FAULT_STAT_IERR); //clear data/instruction access error bits (write 1 to clear)
     int32_t stat = kill_proc(pid);
     if (stat != -1) {
         fput1hUart0("Killed process %p\n\n>", pid);
@@ -33,10 +33,38 @@
  #define NULL 0
 #endif
 
-// task
-#define INVALID_TASK 0xFF
 // tcb
 #define NUM_PRIORITIES   16
+// systick
+#define TICK_CYCLES         40000 // 1ms at 40 MHz
+#define MAX_TICKLESS_TICKS  419   // longest period the 24 bit reload can hold
+// benchmark
+#define BENCH_MAX_TASKS  64
+#define BENCH_ITERATIONS 256
+#define BENCH_RING_BYTES 4096
+#define BENCH_HEAP_OPS   1000
+#define BENCH_HEAP_LIVE  16     // most blocks a heap trace holds at once
+
+// data watchpoint and trace unit (cycle counter)
+#define DWT_CTRL_R              (*((volatile uint32_t *)0xE0001000))
+#define DWT_CYCCNT_R            (*((volatile uint32_t *)0xE0001004))
+#define DWT_CTRL_CYCCNTENA      0x00000001
+#define NVIC_DBG_INT_TRCENA     0x01000000  // Enable DWT and ITM
+
+// context switch
+#define EXC_RETURN_THREAD_PSP   0xFFFFFFFD  // thread mode, psp, basic frame
+// NOT a measured figure: no board was available when the switch moved to switch.s, so this is a
+// generous guess for pendsvIsr plus taskSwitch at 40 MHz. Replace it with the worst switch from
+// "bench CONTEXT" on hardware plus a small margin before relying on the warning.
+#define SWITCH_CYCLE_BUDGET     400         // regression limit for the measured part of pendsvIsr
+
+// stack high water mark
+#define STACK_PAINT     0xC5C5C5C5  // unused stack words hold this until the task first writes them
+
+// fast mutex word
+#define FAST_UNLOCKED   0
+#define FAST_LOCKED     1 // held, nobody waiting
+#define FAST_CONTENDED  2 // held and the holder has to trap on unlock to wake a waiter
 
 //=============================================================================
 // GLOBALS
@@ -47,9 +75,14 @@ uint8_t taskCount = 0;            // total number of valid tasks
 uint8_t firstTask = 1;
 
 // control
-bool priorityScheduler = true;    // priority (true) or round-robin (false)
+uint8_t schedulerMode = SCHED_PRIO; // priority, round-robin or earliest deadline first
 bool priorityInheritance = false; // priority inheritance for mutexes
 bool preemption = true;          // preemption (true) or cooperative (false)
+bool ticklessMode = false;        // stretch systick to the next wakeup when no time slicing is needed
+uint32_t tickStretch = 1;         // ticks covered by the systick period in progress
+bool tickOneShot = false;         // reload holds a one-shot period that the tick isr has to put back
+uint32_t preemptTicks = 0;        // ticks with preemption on, each one used to force a switch
+uint32_t tickSwitches = 0;        // switches the tick actually requested
 
 typedef struct _tcb {
     uint8_t state;                 // see STATE_ values above
@@ -58,18 +91,77 @@ typedef struct _tcb {
     void* sp;                      // current stack pointer
     uint8_t priority;              // 0=highest
     uint8_t currentPriority;       // 0=highest (needed for pi)
-    uint32_t ticks;                // ticks until sleep complete
+    uint32_t ticks;                // ticks after the previous task in the sleep list
+    uint8_t sleepNext;             // next task in the sleep list
     uint64_t srd;                  // MPU subregion disable bits
     uint16_t stackSize;            // Stack size of task
+    uint16_t guardSize;            // inaccessible bytes below the stack, part of the same heap block
+    uint16_t heapQuota;            // most bytes of heap blocks and pool subregions the task may hold, its stack isn't counted
+    uint16_t heapUsed;
+    uint16_t heapPeak;
     uint32_t elapsed[2];
     uint32_t runtime;
     char name[16];                 // name of task used in ps command
     uint8_t mutex;                 // index of the mutex in use or blocking the thread
     uint8_t semaphore;             // index of the semaphore that is blocking the thread
+    uint8_t queue;                 // index of the queue that is blocking the thread
+    uint8_t event;                 // index of the event flags the thread waits on
+    uint8_t fastMutex;             // index of the fast mutex blocking the thread
+    uint8_t rwLock;                // index of the reader-writer lock blocking the thread
+    uint8_t readLocks;             // bit per reader-writer lock held for reading
+    uint8_t cond;                  // index of the condition variable the thread waits on
+    uint8_t pools[POOL_CLASSES];   // block pool of each size class, INVALID_POOL until first used
+    uint32_t* frame;               // stacked R0-xPSR of the svc the thread is blocked in, frame[0] is its return value
+    uint32_t notifyValue;          // direct to task notification
+    uint32_t notifyClear;          // bits notifyWait clears once it takes the notification
+    bool notifyPending;
+    uint32_t period;               // ticks between releases, 0 for non periodic tasks
+    uint32_t deadline;             // deadline relative to the release
+    uint32_t wcet;                 // execution budget per period
+    uint32_t budget;               // budget left in the current job
+    uint32_t release;              // systime of the current job's release
+    uint32_t absDeadline;          // systime the current job is due
+    uint32_t misses;               // jobs finished late or out of budget
+    uint8_t edfNext;               // next task in the deadline-ordered ready list
+    uint8_t waitNext;              // next task in the wait list of the object blocking the thread
+    uint32_t blockedSince;         // systime the task blocked on its mutex
+    uint32_t maxBlocked[2];        // worst mutex blocking time with pi off [0] and on [1]
+    uint32_t excReturn;            // EXC_RETURN to resume the task with
+    uint32_t quantum;              // ticks the task runs before yielding to a ready peer
+    uint32_t sliceLeft;            // ticks left in the current quantum
 } TCB;
 TCB tcb[MAX_TASKS];
 
+//one circular list of ready tasks per priority, bitmap marks non-empty lists
+typedef struct _readyQueue {
+    uint16_t bitmap;               // bit (15 - p) set while priority p has a ready task
+    uint8_t head[NUM_PRIORITIES];  // next task to dispatch at each priority
+    uint8_t* next;                 // list links, indexed the same as tcb[]
+    uint8_t* prev;
+} readyQueue;
+uint8_t readyNext[MAX_TASKS];
+uint8_t readyPrev[MAX_TASKS];
+readyQueue readyTasks = {0, {0}, readyNext, readyPrev};
+
+//ready periodic tasks ordered by absolute deadline
+uint8_t edfHead = INVALID_TASK;
+
+//delayed tasks ordered by wakeup time, each storing its delta to the one before it
+uint8_t sleepHead = INVALID_TASK;
+
+//ring buffers opened by a consumer task, producers in handler mode wake it through ringWakeups
+ringBuffer* rings[MAX_RINGS] = {0};
+uint8_t ringOwner[MAX_RINGS];
+volatile uint8_t ringConsumer[MAX_RINGS];  // task blocked in ringWait, INVALID_TASK if none
+volatile uint32_t ringWakeups = 0;         // bit per ring, set by isrs and drained in pendsvIsr
+
+//fast mutex words live in os memory that region 7 opens to every task, the wait lists stay private
+#pragma DATA_ALIGN(fastMutexes, 32)
+volatile uint32_t fastMutexes[MAX_FAST_MUTEXES] = {0};
+waitList fastWaiters[MAX_FAST_MUTEXES];
+
 uint32_t systime = 0; //in ticks (ms)
+uint32_t switchCycles[2] = {0}; //last and worst pendsvIsr cost, written by switch.s
 uint8_t pingpong = 0; //write to A(0) or B(1)
 //denominator is every time ping pong is switched (2 seconds)
 
@@ -91,6 +183,41 @@ static void pop_from_stack(uint32_t** sp, uint32_t* ptr) {
     (*sp)++;
 }
 
+//fills the whole stack with STACK_PAINT so stackPeak can find the deepest word ever written
+static void paintStack(uint8_t task) {
+    uint32_t* p = (uint32_t*)((uint8_t*)tcb[task].spInit - tcb[task].stackSize);
+    while (p < (uint32_t*)tcb[task].spInit) {
+        *p++ = STACK_PAINT;
+    }
+}
+
+//high-water mark in bytes, scans up from the bottom of the stack until the paint stops
+//only the never-used part is read, so a stack that came close to overflowing is the cheapest to check
+static uint32_t stackPeak(uint8_t task) {
+    uint32_t* p = (uint32_t*)((uint8_t*)tcb[task].spInit - tcb[task].stackSize);
+    while (p < (uint32_t*)tcb[task].spInit && *p == STACK_PAINT) {
+        p++;
+    }
+    return (uint32_t)tcb[task].spInit - (uint32_t)p;
+}
+
+//heap block holding the task's stack and the guard below it
+static uint8_t* stackBlock(uint8_t task) {
+    return (uint8_t*)tcb[task].spInit - tcb[task].stackSize - tcb[task].guardSize;
+}
+
+//allocates a stack of at least bytes, with a guard subregion at the bottom of the block when STACK_GUARD is set
+static uint8_t* allocStack(uint32_t bytes, uint32_t* guard) {
+    *guard = 0;
+    return STACK_GUARD ? mallocGuarded(bytes, guard) : malloc_(bytes);
+}
+
+//true if addr is in the guard below the current task's stack, a fault there is a stack overflow
+bool inStackGuard(uint32_t addr) {
+    uint32_t bottom = (uint32_t)tcb[taskCurrent].spInit - tcb[taskCurrent].stackSize;
+    return addr < bottom && addr >= bottom - tcb[taskCurrent].guardSize;
+}
+
 //makes the thread appear "as if it has run before"
 static void populateInitialStack(uint32_t** sp, _fn fn) {
     push_to_stack(sp, 1 << 24); //xPSR - THUMB bit (24) has to be correct or will fault (functions defined in thumb), 4 flags are arbitrary
@@ -101,21 +228,752 @@ static void populateInitialStack(uint32_t** sp, _fn fn) {
     push_to_stack(sp, 2); //R2 - bogus
     push_to_stack(sp, 1); //R1 - bogus
     push_to_stack(sp, 0); //R0 - bogus
-    push_to_stack(sp, 0xFFFFFFFD); //push LR (R14)
-    push_to_stack(sp, 4); //push R4
-    push_to_stack(sp, 5); //push R5
-    push_to_stack(sp, 6); //push R6
-    push_to_stack(sp, 7); //push R7
-    push_to_stack(sp, 8); //push R8
-    push_to_stack(sp, 9); //push R9
-    push_to_stack(sp, 10); //push R10
     push_to_stack(sp, 11); //push R11
+    push_to_stack(sp, 10); //push R10
+    push_to_stack(sp, 9); //push R9
+    push_to_stack(sp, 8); //push R8
+    push_to_stack(sp, 7); //push R7
+    push_to_stack(sp, 6); //push R6
+    push_to_stack(sp, 5); //push R5
+    push_to_stack(sp, 4); //push R4 - lowest address, first register of LDMIA
 }
 
-static void dequeue(uint8_t q[], uint8_t qsize, uint8_t idx) {
-    uint32_t i;
-    for(i = idx; i < qsize - 1; i++) {
-        q[i] = q[i+1];
+static void initReadyQueue(readyQueue* rq) {
+    uint8_t p;
+    rq->bitmap = 0;
+    for (p = 0; p < NUM_PRIORITIES; p++) {
+        rq->head[p] = INVALID_TASK;
+    }
+}
+
+//adds task to the tail of its priority list so it runs after the tasks already waiting there
+static void readyInsert(readyQueue* rq, uint8_t task, uint8_t prio) {
+    uint8_t head = rq->head[prio];
+    uint8_t tail;
+    if (head == INVALID_TASK) {
+        rq->next[task] = task;
+        rq->prev[task] = task;
+        rq->head[prio] = task;
+        rq->bitmap |= (0x8000 >> prio);
+    }
+    else {
+        tail = rq->prev[head];
+        rq->next[tail] = task;
+        rq->prev[task] = tail;
+        rq->next[task] = head;
+        rq->prev[head] = task;
+    }
+}
+
+static void readyRemove(readyQueue* rq, uint8_t task, uint8_t prio) {
+    if (rq->next[task] == task) { //last task at this priority
+        rq->head[prio] = INVALID_TASK;
+        rq->bitmap &= ~(0x8000 >> prio);
+    }
+    else {
+        rq->next[rq->prev[task]] = rq->next[task];
+        rq->prev[rq->next[task]] = rq->prev[task];
+        if (rq->head[prio] == task) {
+            rq->head[prio] = rq->next[task];
+        }
+    }
+}
+
+//highest priority comes from one CLZ, then the list rotates for round-robin within the level
+//bitmap must not be empty
+static uint8_t readyPop(readyQueue* rq) {
+    uint8_t prio = countLeadingZeros(rq->bitmap) - 16;
+    uint8_t task = rq->head[prio];
+    rq->head[prio] = rq->next[task];
+    return task;
+}
+
+//restarts systick with a one-shot period of cycles, sysTickIsr goes back to one tick at its wrap
+static void programTick(uint32_t cycles) {
+    if (cycles < 2) {
+        cycles = 2; //a reload of 0 would stop the counter
+    }
+    NVIC_ST_RELOAD_R = cycles - 1;
+    NVIC_ST_CURRENT_R = 0; //counter reloads from the new value on the next clock
+    tickOneShot = true;
+}
+
+//true when more than one task can share the cpu, so quanta have to be enforced
+static bool timeSliceNeeded(void) {
+    uint8_t head;
+    if (!preemption || readyTasks.bitmap == 0) {
+        return false;
+    }
+    head = readyTasks.head[countLeadingZeros(readyTasks.bitmap) - 16];
+    if (schedulerMode == SCHED_EDF && edfHead != INVALID_TASK) {
+        return false; //the earliest deadline runs until it finishes or its budget runs out
+    }
+    if (schedulerMode == SCHED_RR) {
+        return (readyTasks.bitmap & (readyTasks.bitmap - 1)) != 0 || readyTasks.next[head] != head;
+    }
+    return readyTasks.next[head] != head;
+}
+
+//called at the end of a tick, skips ticks up to the next sleep deadline if nothing needs preemption
+static void stretchTick(void) {
+    uint32_t n = MAX_TICKLESS_TICKS;
+    if (timeSliceNeeded() && tcb[taskCurrent].sliceLeft < n) {
+        n = tcb[taskCurrent].sliceLeft; //wake up when the quantum ends
+    }
+    if (schedulerMode == SCHED_EDF && tcb[taskCurrent].period != 0 && tcb[taskCurrent].budget < n) {
+        n = tcb[taskCurrent].budget; //budget is charged at the tick
+    }
+    if (sleepHead != INVALID_TASK && tcb[sleepHead].ticks < n) {
+        n = tcb[sleepHead].ticks;
+    }
+    if (n > 1) {
+        //stretched period ends on a tick boundary, so subtract what already ran of this tick
+        programTick(n * TICK_CYCLES - ((TICK_CYCLES - 1) - NVIC_ST_CURRENT_R));
+        tickStretch = n;
+    }
+}
+
+//cuts a stretched period short at the next tick boundary so the tick isr can decide again
+static void tickResume(void) {
+    uint32_t current;
+    if (tickStretch > 1) {
+        current = NVIC_ST_CURRENT_R;
+        tickStretch -= current / TICK_CYCLES; //whole ticks that will no longer be skipped
+        programTick((current % TICK_CYCLES) + 1);
+    }
+}
+
+//systime only catches up when a stretched period ends, after tickResume every tick but the last one in it has passed
+static uint32_t tickNow(void) {
+    tickResume();
+    return systime + tickStretch - 1;
+}
+
+//walks the list to the task's wakeup time, tasks due on the same tick keep their sleep order
+static void sleepInsert(uint8_t task, uint32_t ticks) {
+    uint8_t prev = INVALID_TASK;
+    uint8_t curr = sleepHead;
+    while (curr != INVALID_TASK && tcb[curr].ticks <= ticks) {
+        ticks -= tcb[curr].ticks;
+        prev = curr;
+        curr = tcb[curr].sleepNext;
+    }
+    tcb[task].ticks = ticks;
+    tcb[task].sleepNext = curr;
+    if (curr != INVALID_TASK) {
+        tcb[curr].ticks -= ticks;
+    }
+    if (prev == INVALID_TASK) {
+        sleepHead = task;
+    }
+    else {
+        tcb[prev].sleepNext = task;
+    }
+}
+
+static void sleepRemove(uint8_t task) {
+    uint8_t prev = INVALID_TASK;
+    uint8_t curr = sleepHead;
+    while (curr != INVALID_TASK && curr != task) {
+        prev = curr;
+        curr = tcb[curr].sleepNext;
+    }
+    if (curr != INVALID_TASK) {
+        curr = tcb[task].sleepNext;
+        if (curr != INVALID_TASK) {
+            tcb[curr].ticks += tcb[task].ticks; //successor keeps its wakeup time
+        }
+        if (prev == INVALID_TASK) {
+            sleepHead = curr;
+        }
+        else {
+            tcb[prev].sleepNext = curr;
+        }
+    }
+}
+
+//tasks with equal deadlines keep their arrival order
+static void edfInsert(uint8_t task) {
+    uint8_t prev = INVALID_TASK;
+    uint8_t curr = edfHead;
+    while (curr != INVALID_TASK && (int32_t)(tcb[curr].absDeadline - tcb[task].absDeadline) <= 0) {
+        prev = curr;
+        curr = tcb[curr].edfNext;
+    }
+    tcb[task].edfNext = curr;
+    if (prev == INVALID_TASK) {
+        edfHead = task;
+    }
+    else {
+        tcb[prev].edfNext = task;
+    }
+}
+
+static void edfRemove(uint8_t task) {
+    uint8_t prev = INVALID_TASK;
+    uint8_t curr = edfHead;
+    while (curr != INVALID_TASK && curr != task) {
+        prev = curr;
+        curr = tcb[curr].edfNext;
+    }
+    if (curr != INVALID_TASK) {
+        if (prev == INVALID_TASK) {
+            edfHead = tcb[task].edfNext;
+        }
+        else {
+            tcb[prev].edfNext = tcb[task].edfNext;
+        }
+    }
+}
+
+//starts a new job of a periodic task at release
+static void startJob(uint8_t task, uint32_t release) {
+    bool ready = (tcb[task].state == STATE_READY);
+    if (ready) {
+        edfRemove(task);
+    }
+    tcb[task].release = release;
+    tcb[task].absDeadline = release + tcb[task].deadline;
+    tcb[task].budget = tcb[task].wcet;
+    if (ready) {
+        edfInsert(task);
+    }
+}
+
+//true if a newly ready task should take the cpu from the running one right away
+static bool preemptsCurrent(uint8_t task) {
+    if (!preemption || firstTask || task == taskCurrent) {
+        return false;
+    }
+    if (tcb[taskCurrent].state != STATE_READY) {
+        return true;
+    }
+    if (schedulerMode == SCHED_EDF && tcb[task].period != 0) {
+        return tcb[taskCurrent].period == 0 || (int32_t)(tcb[task].absDeadline - tcb[taskCurrent].absDeadline) < 0;
+    }
+    if (schedulerMode == SCHED_RR) {
+        return false; //waits for the running quantum to end
+    }
+    return tcb[task].currentPriority < tcb[taskCurrent].currentPriority;
+}
+
+//every state change goes through here so the ready lists stay in sync with tcb[].state
+static void setTaskState(uint8_t task, uint8_t state) {
+    if (tcb[task].state == STATE_READY && state != STATE_READY) {
+        readyRemove(&readyTasks, task, tcb[task].currentPriority);
+        if (tcb[task].period != 0) {
+            edfRemove(task);
+        }
+        if (task == taskCurrent) {
+            NVIC_INT_CTRL_R |= NVIC_INT_CTRL_PEND_SV; //the tick only switches out a ready task, so a stopped one would keep running
+        }
+    }
+    else if (tcb[task].state != STATE_READY && state == STATE_READY) {
+        readyInsert(&readyTasks, task, tcb[task].currentPriority);
+        if (tcb[task].period != 0) {
+            edfInsert(task);
+        }
+        if (preemptsCurrent(task)) {
+            NVIC_INT_CTRL_R |= NVIC_INT_CTRL_PEND_SV;
+        }
+    }
+    if (state == STATE_READY || state == STATE_DELAYED) {
+        tickResume(); //new time slice peer or an earlier deadline
+    }
+    tcb[task].state = state;
+}
+
+//tasks of equal priority keep their arrival order
+static void waitInsert(waitList* list, uint8_t task) {
+    uint8_t prev = INVALID_TASK;
+    uint8_t curr = list->head;
+    while (curr != INVALID_TASK && tcb[curr].currentPriority <= tcb[task].currentPriority) {
+        prev = curr;
+        curr = tcb[curr].waitNext;
+    }
+    tcb[task].waitNext = curr;
+    if (prev == INVALID_TASK) {
+        list->head = task;
+    }
+    else {
+        tcb[prev].waitNext = task;
+    }
+    list->size++;
+}
+
+static void waitRemove(waitList* list, uint8_t task) {
+    uint8_t prev = INVALID_TASK;
+    uint8_t curr = list->head;
+    while (curr != INVALID_TASK && curr != task) {
+        prev = curr;
+        curr = tcb[curr].waitNext;
+    }
+    if (curr != INVALID_TASK) {
+        if (prev == INVALID_TASK) {
+            list->head = tcb[task].waitNext;
+        }
+        else {
+            tcb[prev].waitNext = tcb[task].waitNext;
+        }
+        list->size--;
+    }
+}
+
+//removes the highest priority waiter, list must not be empty
+static uint8_t waitPop(waitList* list) {
+    uint8_t task = list->head;
+    list->head = tcb[task].waitNext;
+    list->size--;
+    return task;
+}
+
+//wait list the task is blocked in, NULL if it isn't on one
+static waitList* waitListOf(uint8_t task) {
+    switch (tcb[task].state) {
+    case STATE_BLOCKED_MUTEX:
+        return &mutexes[tcb[task].mutex].waiters;
+    case STATE_BLOCKED_SEMAPHORE:
+        return &semaphores[tcb[task].semaphore].waiters;
+    case STATE_BLOCKED_QUEUE:
+        return &queues[tcb[task].queue].waiters;
+    case STATE_BLOCKED_EVENT:
+        return &events[tcb[task].event].waiters;
+    case STATE_BLOCKED_FAST:
+        return &fastWaiters[tcb[task].fastMutex];
+    case STATE_BLOCKED_READ:
+        return &rwLocks[tcb[task].rwLock].readWaiters;
+    case STATE_BLOCKED_WRITE:
+        return &rwLocks[tcb[task].rwLock].writeWaiters;
+    case STATE_BLOCKED_COND:
+        return &conds[tcb[task].cond].waiters;
+    default:
+        return NULL;
+    }
+}
+
+//release order for the ipcs svc
+static void copyWaitList(waitList* list, uint8_t out[]) {
+    uint8_t task = list->head;
+    uint8_t n = 0;
+    while (task != INVALID_TASK && n < MAX_TASKS) {
+        out[n++] = task;
+        task = tcb[task].waitNext;
+    }
+}
+
+static void initWaitList(waitList* list) {
+    list->head = INVALID_TASK;
+    list->size = 0;
+}
+
+//moves a ready task to the list of its new priority, a blocked one to its new place in the wait list
+static void setTaskPriority(uint8_t task, uint8_t prio) {
+    waitList* list = waitListOf(task);
+    if (tcb[task].state == STATE_READY) {
+        readyRemove(&readyTasks, task, tcb[task].currentPriority);
+        readyInsert(&readyTasks, task, prio);
+        tickResume();
+    }
+    if (list != NULL) {
+        waitRemove(list, task);
+    }
+    tcb[task].currentPriority = prio;
+    if (list != NULL) {
+        waitInsert(list, task);
+    }
+    if (tcb[task].state == STATE_READY && preemptsCurrent(task)) {
+        NVIC_INT_CTRL_R |= NVIC_INT_CTRL_PEND_SV;
+    }
+}
+
+//svc number of the call that stacked frame, the svc instruction is 2 bytes behind the stacked pc
+static uint8_t svcFromFrame(uint32_t* frame) {
+    return ((uint8_t*)frame[6])[-2];
+}
+
+//puts a blocked task on the sleep list too, whichever comes first (timeout or the event) wakes it
+static void startTimeout(uint8_t task, uint32_t ticks) {
+    if (ticks != WAIT_FOREVER) {
+        tickResume(); //deltas count from the last tick isr
+        sleepInsert(task, ticks + tickStretch);
+    }
+}
+
+//wakes a blocked task, status is what its svc returns
+static void wakeWaiter(uint8_t task, uint32_t status) {
+    tcb[task].frame[0] = status;
+    sleepRemove(task); //no longer needs its timeout
+    setTaskState(task, STATE_READY);
+}
+
+//base priority, raised to the ceiling of any ceiling mutex the task holds
+//and to the best waiter on any mutex it holds when pi is on
+static uint8_t inheritedPriority(uint8_t task) {
+    uint8_t prio = tcb[task].priority;
+    uint8_t m, waiter;
+    for (m = 0; m < MAX_MUTEXES; m++) {
+        if (mutexes[m].lock && mutexes[m].lockedBy == task) {
+            if (mutexes[m].ceiling < prio) {
+                prio = mutexes[m].ceiling;
+            }
+            waiter = mutexes[m].waiters.head; //best waiter is at the head
+            if (priorityInheritance && waiter != INVALID_TASK && tcb[waiter].currentPriority < prio) {
+                prio = tcb[waiter].currentPriority;
+            }
+        }
+    }
+    return prio;
+}
+
+//recomputes the task's priority and follows the chain of mutex owners it is blocked behind,
+//so raising and restoring both propagate through nested locks
+static void updatePriorityChain(uint8_t task) {
+    uint8_t prio;
+    uint8_t hops = 0;
+    while (task != INVALID_TASK && hops++ < MAX_TASKS) {
+        prio = inheritedPriority(task);
+        if (prio == tcb[task].currentPriority) {
+            break; //owners further down were derived from this priority
+        }
+        setTaskPriority(task, prio);
+        task = (tcb[task].state == STATE_BLOCKED_MUTEX) ? mutexes[tcb[task].mutex].lockedBy : INVALID_TASK;
+    }
+}
+
+//hands mutex m to the first waiter and drops any priority the owner inherited through it
+static void releaseMutex(uint8_t m) {
+    uint8_t owner = mutexes[m].lockedBy;
+    uint8_t next;
+    uint32_t blocked;
+    mutexes[m].lock = 0;
+    if (mutexes[m].waiters.head != INVALID_TASK) {
+        next = waitPop(&mutexes[m].waiters); //highest priority waiter
+
+        //next task locks mutex
+        mutexes[m].lock = 1;
+        mutexes[m].lockedBy = next;
+        tcb[next].mutex = m;
+        blocked = systime - tcb[next].blockedSince;
+        if (blocked > tcb[next].maxBlocked[priorityInheritance]) {
+            tcb[next].maxBlocked[priorityInheritance] = blocked;
+        }
+        wakeWaiter(next, IPC_OK);
+        updatePriorityChain(next); //inherits from the waiters left behind it
+        NVIC_INT_CTRL_R |= NVIC_INT_CTRL_PEND_SV;
+    }
+    updatePriorityChain(owner);
+}
+
+//a signaled cond_wait takes its mutex back if it is free, otherwise it waits on the mutex without
+//running first, so a broadcast doesn't wake every waiter only for all but one to block again
+static void condRequeue(uint8_t task) {
+    uint8_t m = tcb[task].mutex;
+    tcb[task].cond = INVALID_COND;
+    if (!mutexes[m].lock) {
+        mutexes[m].lock = 1;
+        mutexes[m].lockedBy = task;
+        wakeWaiter(task, IPC_OK);
+        updatePriorityChain(task);
+    }
+    else {
+        tcb[task].blockedSince = systime;
+        waitInsert(&mutexes[m].waiters, task);
+        setTaskState(task, STATE_BLOCKED_MUTEX);
+        updatePriorityChain(mutexes[m].lockedBy);
+    }
+}
+
+//hands a free lock to the best waiting writer, or to every waiting reader if no writer waits
+static void rwGrant(uint8_t rw) {
+    uint8_t next;
+    if (rwLocks[rw].writer != INVALID_TASK) {
+        return;
+    }
+    if (rwLocks[rw].writeWaiters.head != INVALID_TASK) {
+        if (rwLocks[rw].readers == 0) {
+            next = waitPop(&rwLocks[rw].writeWaiters);
+            rwLocks[rw].writer = next;
+            tcb[next].rwLock = INVALID_RWLOCK;
+            wakeWaiter(next, IPC_OK);
+        }
+    }
+    else {
+        while (rwLocks[rw].readWaiters.head != INVALID_TASK) {
+            next = waitPop(&rwLocks[rw].readWaiters);
+            rwLocks[rw].readers++;
+            tcb[next].readLocks |= 1 << rw;
+            tcb[next].rwLock = INVALID_RWLOCK;
+            wakeWaiter(next, IPC_OK);
+        }
+    }
+}
+
+//takes a blocked task off the wait list of whatever it is blocked on, used on timeout and kill
+//the caller changes the task's state right after
+static void cancelWait(uint8_t task) {
+    waitList* list = waitListOf(task);
+    uint8_t m = tcb[task].mutex;
+    uint32_t j;
+    if (list != NULL) {
+        waitRemove(list, task);
+    }
+    if (tcb[task].state == STATE_BLOCKED_MUTEX) {
+        tcb[task].mutex = INVALID_MUTEX;
+        updatePriorityChain(mutexes[m].lockedBy); //owner drops what it inherited from this task
+    }
+    else if (tcb[task].state == STATE_BLOCKED_SEMAPHORE) {
+        tcb[task].semaphore = INVALID_SEMAPHORE;
+    }
+    else if (tcb[task].state == STATE_BLOCKED_WRITE) {
+        m = tcb[task].rwLock;
+        tcb[task].rwLock = INVALID_RWLOCK;
+        rwGrant(m); //readers held back by this writer may go now
+    }
+    else if (tcb[task].state == STATE_BLOCKED_READ) {
+        tcb[task].rwLock = INVALID_RWLOCK;
+    }
+    else if (tcb[task].state == STATE_BLOCKED_COND) {
+        tcb[task].cond = INVALID_COND;
+        tcb[task].mutex = INVALID_MUTEX;
+    }
+    else if (tcb[task].state == STATE_BLOCKED_RING) {
+        for (j = 0; j < MAX_RINGS; j++) {
+            if (ringConsumer[j] == task) {
+                ringConsumer[j] = INVALID_TASK;
+            }
+        }
+    }
+}
+
+//adds a block to or takes it out of task's heap use
+static void chargeHeap(uint8_t task, alloc_entry* block, bool add) {
+    if (add) {
+        tcb[task].heapUsed += block->size;
+        if (tcb[task].heapUsed > tcb[task].heapPeak) {
+            tcb[task].heapPeak = tcb[task].heapUsed;
+        }
+    }
+    else {
+        tcb[task].heapUsed -= block->size;
+    }
+}
+
+//heap block starting at buffer that task can hand over or free, its stack and block pools are excluded
+static alloc_entry* ownedBlock(uint8_t task, void* buffer) {
+    alloc_entry* block = findAlloc(buffer);
+    uint32_t c;
+    if (block == NULL || block->owner != task || (uint8_t*)buffer == stackBlock(task)) {
+        return NULL;
+    }
+    for (c = 0; c < POOL_CLASSES; c++) {
+        if (tcb[task].pools[c] != INVALID_POOL && pools[tcb[task].pools[c]].base == buffer) {
+            return NULL;
+        }
+    }
+    return block;
+}
+
+//appends the message described by the sender's svc arguments (queue, data, size, timeout)
+//a zero copy block stays owned by the sender until received, but the sender loses access to it here
+static void queuePut(uint8_t q, uint8_t sender, uint32_t* frame) {
+    message* msg = &queues[q].slots[(queues[q].head + queues[q].count) % MAX_QUEUE_MESSAGES];
+    uint8_t* data = (uint8_t*)frame[1];
+    alloc_entry* block;
+    uint32_t j;
+    msg->sender = sender;
+    msg->size = frame[2];
+    if (svcFromFrame(frame) == SVC_SENDBUFFER) {
+        block = ownedBlock(sender, data);
+        msg->flags = MSG_ZERO_COPY;
+        msg->buffer = data;
+        removeSramAccessWindow(&tcb[sender].srd, (uint32_t*)data, block->size);
+        if (sender == taskCurrent) {
+            applySramAccessMask(tcb[sender].srd);
+        }
+    }
+    else {
+        msg->flags = MSG_COPY;
+        msg->buffer = NULL;
+        for (j = 0; j < msg->size; j++) {
+            msg->data[j] = data[j];
+        }
+    }
+    queues[q].count++;
+}
+
+//removes the oldest message into msg, a zero copy block is given to the receiver with its mpu window
+static void queueGet(uint8_t q, uint8_t receiver, message* msg) {
+    message* slot = &queues[q].slots[queues[q].head];
+    alloc_entry* block = (slot->buffer != NULL) ? ownedBlock(slot->sender, slot->buffer) : NULL;
+    *msg = *slot;
+    if (block != NULL) {
+        chargeHeap(slot->sender, block, false);
+        setAllocOwner(slot->buffer, receiver);
+        chargeHeap(receiver, block, true); //a handover can take the receiver past its quota, it only limits malloc
+        addSramAccessWindow(&tcb[receiver].srd, (uint32_t*)slot->buffer, block->size);
+        if (receiver == taskCurrent) {
+            applySramAccessMask(tcb[receiver].srd);
+        }
+    }
+    queues[q].head = (queues[q].head + 1) % MAX_QUEUE_MESSAGES;
+    queues[q].count--;
+}
+
+//the caller returns IPC_TIMEOUT unless a peer completes the transfer and wakes it first
+static void blockOnQueue(uint8_t q, uint32_t timeout, uint32_t* frame) {
+    frame[0] = IPC_TIMEOUT;
+    if (timeout != NO_WAIT) {
+        tcb[taskCurrent].frame = frame;
+        tcb[taskCurrent].queue = q;
+        waitInsert(&queues[q].waiters, taskCurrent);
+        setTaskState(taskCurrent, STATE_BLOCKED_QUEUE);
+        startTimeout(taskCurrent, timeout);
+        NVIC_INT_CTRL_R |= NVIC_INT_CTRL_PEND_SV;
+    }
+}
+
+//zero copy blocks still queued by a dying task are freed with the rest of its memory
+static void queueDropSender(uint8_t task) {
+    uint8_t q, j;
+    message* msg;
+    for (q = 0; q < MAX_QUEUES; q++) {
+        for (j = 0; j < queues[q].count; j++) {
+            msg = &queues[q].slots[(queues[q].head + j) % MAX_QUEUE_MESSAGES];
+            if (msg->sender == task && msg->buffer != NULL) {
+                msg->buffer = NULL;
+                msg->size = 0;
+            }
+        }
+    }
+}
+
+//allocates size bytes for the current task within its quota and opens its mpu window, ptr gets the block or NULL
+static uint8_t heapMalloc(uint32_t size, void** ptr) {
+    uint8_t* addr;
+    alloc_entry* block;
+    *ptr = NULL;
+    if (size == 0) {
+        return HEAP_INVALID;
+    }
+    //rounding only adds to size, so this rejects most requests before the search
+    if (tcb[taskCurrent].heapUsed + size > tcb[taskCurrent].heapQuota) {
+        return HEAP_OVER_QUOTA;
+    }
+    addr = malloc_(size);
+    if (addr == NULL) {
+        return HEAP_NO_MEMORY;
+    }
+    block = findAlloc(addr);
+    if (tcb[taskCurrent].heapUsed + block->size > tcb[taskCurrent].heapQuota) {
+        free_to_heap(addr);
+        return HEAP_OVER_QUOTA;
+    }
+    chargeHeap(taskCurrent, block, true);
+    addSramAccessWindow(&tcb[taskCurrent].srd, (uint32_t*)addr, block->size); //add the new malloc into the task's srd
+    applySramAccessMask(tcb[taskCurrent].srd); //apply the srd to the CPU until next context switch
+    *ptr = addr;
+    return HEAP_OK;
+}
+
+//true if task's mpu window covers all size bytes at ptr, so an address passed to an svc is safe to write
+static bool taskCanWrite(uint8_t task, void* ptr, uint32_t size) {
+    uint32_t addr = (uint32_t)ptr;
+    uint32_t sr;
+    if (addr < REGION_0_ADDR || addr > REGION_4_ADDR_TOP - size) {
+        return false;
+    }
+    for (sr = getSubregionFromAddr(ptr); sr <= getSubregionFromAddr((uint8_t*)ptr + size - 1); sr++) {
+        if (tcb[task].srd & (1ULL << sr)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+//like taskCanWrite, but flash is readable by every task too
+static bool taskCanRead(uint8_t task, const void* ptr, uint32_t size) {
+    uint32_t addr = (uint32_t)ptr;
+    return (addr < REGION_FLASH_SIZE && size <= REGION_FLASH_SIZE - addr) || taskCanWrite(task, (void*)ptr, size);
+}
+
+//true while buffer is still waiting in a queue for its receiver to take ownership
+static bool queuedBuffer(void* buffer) {
+    uint8_t q, j;
+    for (q = 0; q < MAX_QUEUES; q++) {
+        for (j = 0; j < queues[q].count; j++) {
+            if (queues[q].slots[(queues[q].head + j) % MAX_QUEUE_MESSAGES].buffer == buffer) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+//bits of mask that are set, or 0 if that doesn't satisfy mode
+static uint32_t eventMatch(uint32_t flags, uint32_t mask, uint8_t mode) {
+    uint32_t match = flags & mask;
+    if ((mode & EVENT_ALL) ? (match != mask) : (match == 0)) {
+        match = 0;
+    }
+    return match;
+}
+
+//wakes every waiter the new flags satisfy in one pass
+//auto clear bits are only removed after the pass, so one set can release several waiters on the same bit
+static void eventsSet(uint8_t e, uint32_t bits) {
+    uint32_t clear = 0;
+    uint32_t match;
+    uint32_t* frame;
+    uint8_t task = events[e].waiters.head;
+    uint8_t next;
+    events[e].flags |= bits;
+    while (task != INVALID_TASK) {
+        next = tcb[task].waitNext;
+        frame = tcb[task].frame; //waitEvents(event, bits, mode, timeout)
+        match = eventMatch(events[e].flags, frame[1], frame[2]);
+        if (match != 0) {
+            if (frame[2] & EVENT_CLEAR) {
+                clear |= match;
+            }
+            waitRemove(&events[e].waiters, task);
+            wakeWaiter(task, match);
+        }
+        task = next;
+    }
+    events[e].flags &= ~clear;
+}
+
+//runs in pendsvIsr, isrs can't touch the task lists so they only leave a bit in ringWakeups
+static void wakeRingConsumers(void) {
+    uint32_t pending = atomicExchange(&ringWakeups, 0);
+    uint8_t id, task;
+    while (pending != 0) {
+        id = 31 - countLeadingZeros(pending);
+        pending &= ~(1 << id);
+        task = ringConsumer[id];
+        if (task != INVALID_TASK) {
+            ringConsumer[id] = INVALID_TASK;
+            wakeWaiter(task, IPC_OK);
+        }
+    }
+}
+
+//returns the notification value, then clears the task's clear bits and the pending flag
+static uint32_t notifyTake(uint8_t task, uint32_t clearBits) {
+    uint32_t value = tcb[task].notifyValue;
+    tcb[task].notifyValue &= ~clearBits;
+    tcb[task].notifyPending = false;
+    return value;
+}
+
+//gives the semaphore to the highest priority waiter, or counts it if nobody waits
+static void semaphorePost(uint8_t s) {
+    uint8_t next;
+    semaphores[s].count++;
+    if (semaphores[s].waiters.head != INVALID_TASK) {
+        next = waitPop(&semaphores[s].waiters);
+        semaphores[s].count--;
+        wakeWaiter(next, IPC_OK);
     }
 }
 
@@ -131,31 +989,385 @@ static uint32_t taskFromPid(uint32_t pid) {
 
 // REQUIRED: Implement prioritization to NUM_PRIORITIES
 static uint8_t rtosScheduler(void) {
-    static uint8_t task = 0xFF;
-    static uint8_t currIdxPrio[NUM_PRIORITIES] = {0};
+    static uint8_t task = 0;
+    uint8_t i;
+    if (readyTasks.bitmap == 0) {
+        //never hand back a task that was just stopped, idle can't be stopped so it is always safe
+        return IDLE_TASK;
+    }
+    if (schedulerMode == SCHED_EDF && edfHead != INVALID_TASK) {
+        return edfHead;
+    }
+    if (schedulerMode != SCHED_RR) {
+        return readyPop(&readyTasks); //non periodic tasks run by priority when no deadline is pending
+    }
+    for (i = 0; i < MAX_TASKS; i++) {
+        task = (task + 1) % MAX_TASKS;
+        if (tcb[task].state == STATE_READY) {
+            break;
+        }
+    }
+    return task;
+}
+
+//previous scheduler: scan every tcb for the highest ready priority, then spin to the next task at it
+static uint8_t benchLinearScheduler(uint8_t prio[], uint8_t state[], uint8_t count, uint8_t currIdxPrio[]) {
     bool ok = false;
     uint8_t i;
     uint8_t highestPrio = 0xFF;
-    if (priorityScheduler) {
-        for (i = 0; i < MAX_TASKS; i++) {
-            if (tcb[i].priority < highestPrio && tcb[i].state == STATE_READY) {
-                highestPrio = tcb[i].priority;
-            }
+    for (i = 0; i < count; i++) {
+        if (prio[i] < highestPrio && state[i] == STATE_READY) {
+            highestPrio = prio[i];
         }
     }
     while (!ok) {
-        if (priorityScheduler) {
-            currIdxPrio[highestPrio]++;
-            currIdxPrio[highestPrio] %= taskCount;
-            ok = (tcb[currIdxPrio[highestPrio]].state == STATE_READY) && (tcb[currIdxPrio[highestPrio]].priority == highestPrio);
+        currIdxPrio[highestPrio]++;
+        currIdxPrio[highestPrio] %= count;
+        ok = (state[currIdxPrio[highestPrio]] == STATE_READY) && (prio[currIdxPrio[highestPrio]] == highestPrio);
+    }
+    return currIdxPrio[highestPrio];
+}
+
+//dispatch cost at 4, 12 and 64 tasks with every 4th task blocked, averaged over BENCH_ITERATIONS
+//the simulated tasks live in a heap block for the run, the 4 KiB os area has no room for them
+static void benchScheduler(benchInfo* info) {
+    static const uint8_t counts[3] = {4, 12, BENCH_MAX_TASKS};
+    uint8_t* scratch = malloc_(4 * BENCH_MAX_TASKS + NUM_PRIORITIES);
+    uint8_t* prio = scratch;
+    uint8_t* state = prio + BENCH_MAX_TASKS;
+    uint8_t* next = state + BENCH_MAX_TASKS;
+    uint8_t* prev = next + BENCH_MAX_TASKS;
+    uint8_t* currIdxPrio = prev + BENCH_MAX_TASKS;
+    readyQueue rq = {0, {0}, next, prev};
+    uint32_t n, i, t, start;
+    info->rows = 0;
+    if (scratch == NULL) {
+        return;
+    }
+    for (n = 0; n < 3; n++) {
+        initReadyQueue(&rq);
+        for (i = 0; i < NUM_PRIORITIES; i++) {
+            currIdxPrio[i] = 0;
+        }
+        for (i = 0; i < counts[n]; i++) {
+            prio[i] = 8 + (i % 8); //spread over the lower half of the priorities
+            state[i] = (i % 4 == 0) ? STATE_BLOCKED_SEMAPHORE : STATE_READY;
+            if (state[i] == STATE_READY) {
+                readyInsert(&rq, i, prio[i]);
+            }
+        }
+        start = DWT_CYCCNT_R;
+        for (t = 0; t < BENCH_ITERATIONS; t++) {
+            benchLinearScheduler(prio, state, counts[n], currIdxPrio);
+        }
+        info->before[n] = (DWT_CYCCNT_R - start) / BENCH_ITERATIONS;
+        start = DWT_CYCCNT_R;
+        for (t = 0; t < BENCH_ITERATIONS; t++) {
+            readyPop(&rq);
+        }
+        info->after[n] = (DWT_CYCCNT_R - start) / BENCH_ITERATIONS;
+        tostring(counts[n], info->label[n], 10);
+        str_copy(info->label[n] + str_length(info->label[n]), " tasks");
+    }
+    free_to_heap(scratch);
+    info->rows = 3;
+    str_copy(info->unit, "cycles");
+}
+
+//worst mutex blocking time per task with pi off and on, read by 'bench PI' after running both
+static void benchBlocking(benchInfo* info, bool reset) {
+    uint32_t i;
+    info->rows = 0;
+    for (i = 0; i < MAX_TASKS; i++) {
+        if (reset) {
+            tcb[i].maxBlocked[0] = 0;
+            tcb[i].maxBlocked[1] = 0;
+        }
+        else if (info->rows < MAX_BENCH_ROWS && (tcb[i].maxBlocked[0] != 0 || tcb[i].maxBlocked[1] != 0)) {
+            str_copy(info->label[info->rows], tcb[i].name);
+            info->before[info->rows] = tcb[i].maxBlocked[0];
+            info->after[info->rows] = tcb[i].maxBlocked[1];
+            info->rows++;
+        }
+    }
+    str_copy(info->unit, "ms");
+}
+
+//tick driven switches: one per tick before, only expired quanta with a waiting peer now
+static void benchSwitches(benchInfo* info) {
+    str_copy(info->label[0], "tick switches");
+    info->before[0] = preemptTicks;
+    info->after[0] = tickSwitches;
+    str_copy(info->label[1], "avoided");
+    info->before[1] = 0;
+    info->after[1] = preemptTicks - tickSwitches;
+    info->rows = 2;
+    str_copy(info->unit, "count");
+}
+
+//pendsvIsr cost from entry to the start of the register restore, checked against SWITCH_CYCLE_BUDGET
+static void benchContextSwitch(benchInfo* info) {
+    str_copy(info->label[0], "last switch");
+    info->before[0] = SWITCH_CYCLE_BUDGET;
+    info->after[0] = switchCycles[0];
+    str_copy(info->label[1], "worst switch");
+    info->before[1] = SWITCH_CYCLE_BUDGET;
+    info->after[1] = switchCycles[1];
+    info->rows = 2;
+    str_copy(info->unit, "cycles");
+    switchCycles[1] = 0; //next run reports the worst case since this one
+}
+
+//bytes per second through a 256 byte ring in 1 and 16 byte chunks, both buffers are a heap block for the run
+//before masks interrupts around every call like a locked queue would, after is the lock-free ring
+static void benchRing(benchInfo* info) {
+    static const uint8_t chunks[2] = {1, 16};
+    uint8_t* data = malloc_(256 + 16);
+    uint8_t* chunk = data + 256;
+    ringBuffer r;
+    uint32_t n, b, start;
+    info->rows = 0;
+    if (data == NULL) {
+        return;
+    }
+    initRing(&r, data, 256);
+    for (n = 0; n < 2; n++) {
+        start = DWT_CYCCNT_R;
+        for (b = 0; b < BENCH_RING_BYTES; b += chunks[n]) {
+            __asm(" CPSID I");
+            ringPut(&r, chunk, chunks[n]);
+            __asm(" CPSIE I");
+            __asm(" CPSID I");
+            ringGet(&r, chunk, chunks[n]);
+            __asm(" CPSIE I");
+        }
+        info->before[n] = ((uint64_t)BENCH_RING_BYTES * 40000000) / (DWT_CYCCNT_R - start);
+        start = DWT_CYCCNT_R;
+        for (b = 0; b < BENCH_RING_BYTES; b += chunks[n]) {
+            ringPut(&r, chunk, chunks[n]);
+            ringGet(&r, chunk, chunks[n]);
+        }
+        info->after[n] = ((uint64_t)BENCH_RING_BYTES * 40000000) / (DWT_CYCCNT_R - start);
+        str_copy(info->label[n], chunks[n] == 1 ? "1 byte ops" : "16 byte ops");
+    }
+    free_to_heap(data);
+    info->rows = 2;
+    str_copy(info->unit, "B/s");
+}
+
+//previous malloc_ search: one subregion bit at a time, <= 512 B only from the 512 B zone, larger only from the 1 KiB zone
+static int32_t benchFirstFit(uint64_t map, uint32_t bytes, uint32_t* size) {
+    uint32_t x = bytes <= 512 ? 512 : 1024;
+    uint32_t gsr, srSize;
+    uint32_t contig = 0;
+    *size = (bytes + (x - ((bytes - 1) % x) - 1));
+    for (gsr = 0; gsr < 40; gsr++) {
+        if (~map & (1ULL << gsr)) {
+            contig++;
+            srSize = gsr < 24 ? 512 : 1024;
+            if (*size > srSize && srSize == 1024 && contig == *size / 1024) {
+                return gsr - contig + 1;
+            }
+            else if (*size == srSize) {
+                return gsr;
+            }
         }
         else {
-            task++;
-            task %= taskCount;
-            ok = (tcb[task].state == STATE_READY);
+            contig = 0;
         }
     }
-    return priorityScheduler ? currIdxPrio[highestPrio] : task;
+    return -1;
+}
+
+//replays one random malloc/free trace on an empty heap map with each search,
+//allocations that failed are skipped when the trace frees them
+static void benchHeap(benchInfo* info) {
+    int32_t where[BENCH_HEAP_LIVE];
+    uint32_t sizes[BENCH_HEAP_LIVE];
+    uint64_t map;
+    uint32_t seed, op, r, live, bytes, size, j, k, n, start, cycles, attempts, ok;
+    uint8_t a;
+    for (a = 0; a < 2; a++) {
+        map = 0;
+        seed = 0x1234;
+        live = cycles = attempts = ok = 0;
+        for (op = 0; op < BENCH_HEAP_OPS; op++) {
+            seed = seed * 1103515245 + 12345;
+            r = seed >> 8;
+            if (live < BENCH_HEAP_LIVE && (live == 0 || (r & 3) != 0)) {
+                bytes = 128 + (r >> 2) % 3072;
+                start = DWT_CYCCNT_R;
+                where[live] = (a == 0) ? benchFirstFit(map, bytes, &size) : heapFit(map, bytes, 0, &size);
+                if (where[live] >= 0) {
+                    n = size / (where[live] < 24 ? 512 : 1024);
+                    for (j = where[live]; j < where[live] + n; j++) {
+                        map |= 1ULL << j;
+                    }
+                    ok++;
+                }
+                cycles += DWT_CYCCNT_R - start;
+                sizes[live++] = size;
+                attempts++;
+            }
+            else {
+                k = (r >> 2) % live;
+                start = DWT_CYCCNT_R;
+                if (where[k] >= 0) {
+                    n = sizes[k] / (where[k] < 24 ? 512 : 1024);
+                    for (j = where[k]; j < where[k] + n; j++) {
+                        map &= ~(1ULL << j);
+                    }
+                }
+                cycles += DWT_CYCCNT_R - start;
+                where[k] = where[--live];
+                sizes[k] = sizes[live];
+            }
+        }
+        if (a == 0) {
+            info->before[0] = (1000 * ok) / attempts;
+            info->before[1] = cycles / BENCH_HEAP_OPS;
+        }
+        else {
+            info->after[0] = (1000 * ok) / attempts;
+            info->after[1] = cycles / BENCH_HEAP_OPS;
+        }
+    }
+    str_copy(info->label[0], "ok per 1000");
+    str_copy(info->label[1], "cycles/op");
+    info->rows = 2;
+    str_copy(info->unit, "value");
+}
+
+//rebuilds a stopped task like createThread did, with a fresh stack, false if there is no room for it
+static bool restartTask(uint8_t i) {
+    uint32_t guard;
+    uint8_t* alloc = allocStack(tcb[i].stackSize, &guard); //returns base addr (bottom), the guard is the lowest part
+    if (alloc != NULL) {
+        setAllocOwner(alloc, i);
+        tcb[i].stackSize = findAlloc(alloc)->size - guard;
+        tcb[i].guardSize = guard;
+        uint32_t* sp = (uint32_t*)(alloc + guard + tcb[i].stackSize);//tcb[i].spInit; //set stack ptr to top of region bc stack decrement
+        tcb[i].spInit = sp; //set initial stack pointer to stack base
+        tcb[i].sp = sp; //set stack pointer to stack base (stack pointer decrements on push)
+        paintStack(i);
+        populateInitialStack((uint32_t**)&tcb[i].sp, (uint32_t**)tcb[i].pid); //push everything onto the stack to make it appear as if it has ran before
+        tcb[i].excReturn = EXC_RETURN_THREAD_PSP;
+        uint64_t taskSrd = createNoSramAccessMask(); //create mask for no sram access
+        addSramAccessWindow(&taskSrd, (uint32_t*)(tcb[i].spInit-tcb[i].stackSize), tcb[i].stackSize); //modify srd mask to add access to malloc'd region
+        tcb[i].srd = taskSrd; //set task srd to newly created srd
+        tcb[i].semaphore = INVALID_SEMAPHORE;
+        tcb[i].mutex = INVALID_MUTEX;
+        tcb[i].queue = INVALID_QUEUE;
+        tcb[i].event = INVALID_EVENT;
+        tcb[i].rwLock = INVALID_RWLOCK;
+        tcb[i].readLocks = 0;
+        tcb[i].cond = INVALID_COND;
+        tcb[i].notifyValue = 0;
+        tcb[i].notifyPending = false;
+        if (tcb[i].period != 0) {
+            startJob(i, systime);
+        }
+        setTaskState(i, STATE_READY); //set task state to ready
+    }
+    return alloc != NULL;
+}
+
+//answers bench PINGPONG, the shell's round trips go through the semaphores first, then through notifications
+//the shell notifies with its pid as the value, so the answer needs no argument patched into the frame
+static void benchPongTask(void) {
+    uint32_t i;
+    while (true) {
+        for (i = 0; i < BENCH_ROUND_TRIPS; i++) {
+            wait(benchPing);
+            post(benchPong);
+        }
+        for (i = 0; i < BENCH_ROUND_TRIPS; i++) {
+            notify((_fn)notifyWait(0xFFFFFFFF, WAIT_FOREVER), 1, NOTIFY_INCREMENT);
+        }
+    }
+}
+
+//the pong task and its semaphores only exist while the benchmark runs
+static bool benchPongStart(void) {
+    uint8_t i;
+    for (i = benchPing; i <= benchPong; i++) {
+        semaphores[i].count = 0;
+        initWaitList(&semaphores[i].waiters);
+    }
+    i = taskFromPid((uint32_t)benchPongTask);
+    if (i == INVALID_TASK) {
+        return createThread(benchPongTask, "Pong", BENCH_PRIORITY, 512, DEFAULT_QUANTUM, 0);
+    }
+    return (tcb[i].state == STATE_STOPPED) && restartTask(i); //a slot that couldn't be given back
+}
+
+//frees the pong task's memory and gives its tcb slot back when it is the last one, as it is unless a
+//task was created while the benchmark ran
+static void benchPongStop(void) {
+    uint8_t i = taskFromPid((uint32_t)benchPongTask);
+    if (i != INVALID_TASK && kill_proc((uint32_t)benchPongTask) != -1 && i == taskCount - 1) {
+        tcb[i].state = STATE_INVALID;
+        tcb[i].pid = NULL;
+        taskCount--;
+    }
+}
+
+//the caller runs above every peer in priority mode, so a measured loop only pays for its own switches
+static void benchExclusive(bool on) {
+    static uint8_t savedPriority;
+    static uint8_t savedMode;
+    if (on) {
+        savedPriority = tcb[taskCurrent].priority;
+        savedMode = schedulerMode;
+        tcb[taskCurrent].priority = BENCH_PRIORITY;
+    }
+    else {
+        benchPongStop();
+        tcb[taskCurrent].priority = savedPriority;
+    }
+    schedulerMode = on ? SCHED_PRIO : savedMode;
+    updatePriorityChain(taskCurrent);
+    tickResume();
+}
+
+static void runKernelBench(uint8_t bench, benchInfo* info) {
+    static uint32_t lap = 0;
+    switch (bench) {
+    case BENCH_SCHED:
+        benchScheduler(info);
+        break;
+    case BENCH_BLOCKING:
+        benchBlocking(info, false);
+        break;
+    case BENCH_BLOCKING_RESET:
+        benchBlocking(info, true);
+        break;
+    case BENCH_SWITCHES:
+        benchSwitches(info);
+        break;
+    case BENCH_CONTEXT:
+        benchContextSwitch(info);
+        break;
+    case BENCH_RING:
+        benchRing(info);
+        break;
+    case BENCH_HEAP:
+        benchHeap(info);
+        break;
+    case BENCH_EXCLUSIVE:
+        benchExclusive(true);
+        break;
+    case BENCH_EXCLUSIVE_END:
+        benchExclusive(false);
+        break;
+    case BENCH_PONG:
+        info->after[0] = benchPongStart();
+        break;
+    case BENCH_LAP:
+        info->after[0] = DWT_CYCCNT_R - lap;
+        lap = DWT_CYCCNT_R;
+        break;
+    }
 }
 
 //=============================================================================
@@ -174,11 +1386,15 @@ uint32_t getSysTime() {
     return systime;
 }
 
-bool initMutex(uint8_t mutex) {
-    bool ok = (mutex < MAX_MUTEXES);
+//ceiling is the highest priority of any task that locks the mutex (immediate priority ceiling),
+//or NO_CEILING for a plain mutex
+bool initMutex(uint8_t mutex, uint8_t ceiling) {
+    bool ok = (mutex < MAX_MUTEXES) && (ceiling < NUM_PRIORITIES || ceiling == NO_CEILING);
     if (ok) {
         mutexes[mutex].lock = false;
         mutexes[mutex].lockedBy = 0;
+        mutexes[mutex].ceiling = ceiling;
+        initWaitList(&mutexes[mutex].waiters);
     }
     return ok;
 }
@@ -187,6 +1403,27 @@ bool initSemaphore(uint8_t semaphore, uint8_t count) {
     bool ok = (semaphore < MAX_SEMAPHORES);
     if (ok) {
         semaphores[semaphore].count = count;
+        initWaitList(&semaphores[semaphore].waiters);
+    }
+    return ok;
+}
+
+bool initRwLock(uint8_t rwLock) {
+    bool ok = (rwLock < MAX_RWLOCKS);
+    if (ok) {
+        rwLocks[rwLock].readers = 0;
+        rwLocks[rwLock].writer = INVALID_TASK;
+        initWaitList(&rwLocks[rwLock].readWaiters);
+        initWaitList(&rwLocks[rwLock].writeWaiters);
+    }
+    return ok;
+}
+
+bool initEvents(uint8_t event, uint32_t flags) {
+    bool ok = (event < MAX_EVENTS);
+    if (ok) {
+        events[event].flags = flags;
+        initWaitList(&events[event].waiters);
     }
     return ok;
 }
@@ -196,9 +1433,51 @@ void initRtos(void) {
     uint8_t i;
 
     //init sysTick (1ms)
-    NVIC_ST_RELOAD_R = (40e3)-1; //set timer to 1ms
+    NVIC_ST_RELOAD_R = TICK_CYCLES - 1; //set timer to 1ms
     NVIC_ST_CTRL_R |= NVIC_ST_CTRL_INTEN | NVIC_ST_CTRL_CLK_SRC | NVIC_ST_CTRL_ENABLE; //set clk src to sysclk, enable systick
 
+    //enable the fpu with lazy stacking, the hardware only saves S0-S15 if a handler uses the fpu
+    NVIC_CPAC_R |= NVIC_CPAC_CP10_FULL | NVIC_CPAC_CP11_FULL;
+    NVIC_FPCC_R |= NVIC_FPCC_ASPEN | NVIC_FPCC_LSPEN;
+    __asm(" DSB");
+    __asm(" ISB");
+
+    //start the cycle counter used by the benchmarks
+    NVIC_DBG_INT_R |= NVIC_DBG_INT_TRCENA;
+    DWT_CYCCNT_R = 0;
+    DWT_CTRL_R |= DWT_CTRL_CYCCNTENA;
+
+    initReadyQueue(&readyTasks);
+    initAllocTable();
+
+    for (i = 0; i < MAX_RINGS; i++) {
+        ringConsumer[i] = INVALID_TASK;
+    }
+
+    //every wait list starts empty, init calls may skip unused objects
+    for (i = 0; i < MAX_MUTEXES; i++) {
+        initWaitList(&mutexes[i].waiters);
+    }
+    for (i = 0; i < MAX_SEMAPHORES; i++) {
+        initWaitList(&semaphores[i].waiters);
+    }
+    for (i = 0; i < MAX_QUEUES; i++) {
+        initWaitList(&queues[i].waiters);
+    }
+    for (i = 0; i < MAX_EVENTS; i++) {
+        initWaitList(&events[i].waiters);
+    }
+    for (i = 0; i < MAX_FAST_MUTEXES; i++) {
+        initWaitList(&fastWaiters[i]);
+    }
+    for (i = 0; i < MAX_RWLOCKS; i++) {
+        initRwLock(i);
+    }
+    for (i = 0; i < MAX_CONDS; i++) {
+        initWaitList(&conds[i].waiters);
+    }
+    allowSharedAccess((void*)fastMutexes, sizeof(fastMutexes));
+
     // no tasks running
     taskCount = 0;
     // clear out tcb records
@@ -220,9 +1499,12 @@ void startRtos(void) {
 }
 
 
-bool createThread(_fn fn, const char name[], uint8_t priority, uint32_t stackBytes) {
+//heapQuota limits the bytes the task can hold from malloc_from_heap and its block pools, NO_HEAP_QUOTA for no limit
+bool createThread(_fn fn, const char name[], uint8_t priority, uint32_t stackBytes, uint32_t quantum, uint32_t heapQuota) {
     bool ok = false;
     uint8_t i = 0;
+    uint8_t k;
+    uint32_t guard;
     bool found = false;
     if (taskCount < MAX_TASKS) {
         // make sure fn not already in list (prevent reentrancy)
@@ -232,29 +1514,53 @@ bool createThread(_fn fn, const char name[], uint8_t priority, uint32_t stackByt
         if (!found) {
             // find first available tcb record
             i = 0;
-            uint8_t* alloc = malloc_(stackBytes); //returns base addr (bottom)
+            uint8_t* alloc = allocStack(stackBytes, &guard); //returns base addr (bottom), the guard is the lowest part
             if (alloc != NULL) {
                 if (str_length(name) < 16) {
                     for (i = 0; tcb[i].state != STATE_INVALID; i++); //set i to next available tcb entry
                     str_copy(tcb[i].name, name); //store thread name
-                    tcb[i].state = STATE_READY; //set task state to ready
                     tcb[i].pid = fn; //set pid to function addr
-                    uint32_t size = (stackBytes + ((stackBytes <= 512 ? 512 : 1024) - ((stackBytes - 1) % (stackBytes <= 512 ? 512 : 1024)) - 1)); //rounds bytes up to nearest multiple of 512 if bytes <= 512, else multiple of 1024
-                    uint32_t* sp = (uint32_t*)(alloc + size); //set stack ptr to top of region bc stack decrement //alloc+stackBytes
+                    setAllocOwner(alloc, i);
+                    uint32_t size = findAlloc(alloc)->size - guard; //whole subregions, 512 or 1024 B each depending on where it landed
+                    uint32_t* sp = (uint32_t*)(alloc + guard + size); //set stack ptr to top of region bc stack decrement //alloc+stackBytes
                     tcb[i].stackSize = size; //stackBytes
+                    tcb[i].guardSize = guard;
                     tcb[i].spInit = sp; //set initial stack pointer to stack base
                     tcb[i].sp = sp; //set stack pointer to stack base (stack pointer decrements on push)
+                    paintStack(i);
                     populateInitialStack((uint32_t**)&tcb[i].sp, (uint32_t**)fn); //push everything onto the stack to make it appear as if it has ran before
+                    tcb[i].excReturn = EXC_RETURN_THREAD_PSP;
                     tcb[i].priority = priority;
+                    tcb[i].currentPriority = priority;
                     tcb[i].elapsed[0] = 0;
                     tcb[i].elapsed[1] = 0;
                     uint64_t taskSrd = createNoSramAccessMask(); //create mask for no sram access
-                    addSramAccessWindow(&taskSrd, (uint32_t*)alloc, stackBytes); //modify srd mask to add access to malloc'd region
+                    addSramAccessWindow(&taskSrd, (uint32_t*)(alloc + guard), size); //modify srd mask to add access to the stack, not the guard
                     tcb[i].srd = taskSrd; //set task srd to newly created srd
                     tcb[i].semaphore = INVALID_SEMAPHORE;
                     tcb[i].mutex = INVALID_MUTEX;
+                    tcb[i].queue = INVALID_QUEUE;
+                    tcb[i].event = INVALID_EVENT;
+                    tcb[i].rwLock = INVALID_RWLOCK;
+                    tcb[i].readLocks = 0;
+                    tcb[i].cond = INVALID_COND;
+                    for (k = 0; k < POOL_CLASSES; k++) {
+                        tcb[i].pools[k] = INVALID_POOL;
+                    }
+                    tcb[i].notifyValue = 0;
+                    tcb[i].notifyPending = false;
+                    tcb[i].period = 0;
+                    tcb[i].misses = 0;
+                    tcb[i].quantum = (quantum != 0) ? quantum : DEFAULT_QUANTUM;
+                    tcb[i].sliceLeft = tcb[i].quantum;
+                    tcb[i].heapQuota = (heapQuota < NO_HEAP_QUOTA) ? heapQuota : NO_HEAP_QUOTA;
+                    tcb[i].heapUsed = 0;
+                    tcb[i].heapPeak = 0;
+                    setTaskState(i, STATE_READY); //set task state to ready
                     taskCount++; // increment task count
-                    taskCurrent++;
+                    if (firstTask) {
+                        taskCurrent++; //threads created by the kernel after startRtos keep the running task
+                    }
                     ok = true;
                 }
             }
@@ -263,63 +1569,75 @@ bool createThread(_fn fn, const char name[], uint8_t priority, uint32_t stackByt
     return ok;
 }
 
+//periodic task released every period ticks, due deadline ticks after each release
+//and allowed wcet ticks of cpu per job before its deadline is postponed by a period
+bool createPeriodicThread(_fn fn, const char name[], uint8_t priority, uint32_t stackBytes, uint32_t period, uint32_t deadline, uint32_t wcet, uint32_t heapQuota) {
+    bool ok = (period != 0 && deadline != 0 && wcet != 0 && createThread(fn, name, priority, stackBytes, DEFAULT_QUANTUM, heapQuota));
+    uint32_t i;
+    if (ok) {
+        i = taskFromPid((uint32_t)fn);
+        setTaskState(i, STATE_STOPPED); //leave the ready lists while becoming periodic
+        tcb[i].period = period;
+        tcb[i].deadline = deadline;
+        tcb[i].wcet = wcet;
+        startJob(i, systime);
+        setTaskState(i, STATE_READY);
+    }
+    return ok;
+}
+
 int32_t kill_proc(uint32_t pid) { //svc stuff goes in here
     uint32_t i = taskFromPid(pid);
-    uint32_t j, next;
+    uint32_t j;
     uint32_t stat = 1;
-    if (i != INVALID_TASK) {
+    if (i != INVALID_TASK && i != IDLE_TASK) {
         if (tcb[i].state != STATE_STOPPED) {
-            //if mutex is locked by the current process
-            if (tcb[i].mutex != INVALID_MUTEX) {
-                if (mutexes[tcb[i].mutex].lock && mutexes[tcb[i].mutex].lockedBy == i) {
-                    mutexes[tcb[i].mutex].lock = 0;
-                    if (mutexes[tcb[i].mutex].queueSize > 0) {
-                        next = mutexes[tcb[i].mutex].processQueue[0];
-                        tcb[next].state = STATE_READY;
-                        dequeue(mutexes[tcb[i].mutex].processQueue, mutexes[tcb[i].mutex].queueSize, 0);
-                        mutexes[tcb[i].mutex].lock = 1;
-                        mutexes[tcb[i].mutex].lockedBy = next;
-                        mutexes[tcb[i].mutex].queueSize--;
-                    }
-                }
-                else {
-                    for (j = 0; j < mutexes[tcb[i].mutex].queueSize; j++) {
-                        if (mutexes[tcb[i].mutex].processQueue[j] == i) {
-                            dequeue(mutexes[tcb[i].mutex].processQueue, mutexes[tcb[i].mutex].queueSize, j);
-                            mutexes[tcb[i].mutex].queueSize--;
-                        }
-                    }
+            //leave any wait list, a mutex owner drops what it inherited from this task
+            cancelWait(i);
+            sleepRemove(i); //delayed or waiting with a timeout
+            setTaskState(i, STATE_STOPPED);
+            //unlock every mutex held by the process, nested locks included
+            for (j = 0; j < MAX_MUTEXES; j++) {
+                if (mutexes[j].lock && mutexes[j].lockedBy == i) {
+                    releaseMutex(j);
                 }
             }
-            //if not locked by process, check if it's in queue and remove it
+            tcb[i].mutex = INVALID_MUTEX;
+            //give back a semaphore the task took and never posted
             if (tcb[i].semaphore != INVALID_SEMAPHORE) {
-                semaphores[tcb[i].semaphore].count++; //increment semaphore
-                if (tcb[i].state == STATE_BLOCKED_SEMAPHORE) {
-                    //if this task is in the semaphore's queue
-                    for (j = 0; j < semaphores[tcb[i].semaphore].queueSize; j++) {
-                        if (semaphores[tcb[i].semaphore].processQueue[j] == i) {
-                            dequeue(semaphores[tcb[i].semaphore].processQueue, semaphores[tcb[i].semaphore].queueSize, j);
-                            semaphores[tcb[i].semaphore].queueSize--;//get rid of it
-                            semaphores[tcb[i].semaphore].count--;
-                        }
-                    }
-                    //if another task in queue for semaphore, post it
-                    if (semaphores[tcb[i].semaphore].queueSize > 0) {
-                        next = semaphores[tcb[i].semaphore].processQueue[0];
-                        tcb[next].state = STATE_READY;
-                        dequeue(semaphores[tcb[i].semaphore].processQueue, semaphores[tcb[i].semaphore].queueSize, 0);
-                        semaphores[tcb[i].semaphore].queueSize--;
-                        semaphores[tcb[i].semaphore].count--;
-                    }
+                semaphorePost(tcb[i].semaphore);
+                tcb[i].semaphore = INVALID_SEMAPHORE;
+            }
+            //drop read and write holds, then let the waiters in
+            for (j = 0; j < MAX_RWLOCKS; j++) {
+                if (tcb[i].readLocks & (1 << j)) {
+                    rwLocks[j].readers--;
+                }
+                if (rwLocks[j].writer == i) {
+                    rwLocks[j].writer = INVALID_TASK;
                 }
+                rwGrant(j);
             }
-            //free any allocations that belong to the task
-            for (j = 0; j < MAX_ALLOCS; j++) {
-                if (allocTable[j].valid && allocTable[j].owner == i) {
-                    free_to_heap(allocTable[j].ptr); //how do i check if task freeing owns memory
+            tcb[i].readLocks = 0;
+            queueDropSender(i);
+            //rings live in the task's memory, which is about to be freed
+            for (j = 0; j < MAX_RINGS; j++) {
+                if (rings[j] != NULL && ringOwner[j] == i) {
+                    rings[j] = NULL;
+                }
+            }
+            //block pools first, each one gives its subregion back to the heap
+            for (j = 0; j < POOL_CLASSES; j++) {
+                if (tcb[i].pools[j] != INVALID_POOL) {
+                    deletePool(tcb[i].pools[j]);
+                    tcb[i].pools[j] = INVALID_POOL;
                 }
             }
-            tcb[i].state = STATE_STOPPED;
+            //free any allocations that belong to the task
+            freeOwned(i);
+            tcb[i].heapUsed = 0;
+            setTaskState(i, STATE_STOPPED);
+            setTaskPriority(i, tcb[i].priority);
         }
         else {
             stat = -1;
@@ -342,8 +1660,10 @@ void sleep(uint32_t tick) {
     __asm(" SVC #0x02");
 }
 
-void lock(int8_t mutex) {
+//returns IPC_OK, or IPC_INVALID if the caller's priority is above the mutex ceiling
+uint8_t lock(int8_t mutex) {
     __asm(" SVC #0x03");
+    return getR0();
 }
 
 void unlock(int8_t mutex) {
@@ -358,6 +1678,148 @@ void post(int8_t semaphore) {
     __asm(" SVC #0x06");
 }
 
+//lock() that gives up after timeout ticks, returns IPC_OK once the mutex is held, IPC_TIMEOUT or IPC_INVALID
+uint8_t lock_timeout(int8_t mutex, uint32_t timeout) {
+    __asm(" SVC #0x1C");
+    return getR0();
+}
+
+//wait() that gives up after timeout ticks, returns IPC_OK or IPC_TIMEOUT
+uint8_t wait_timeout(int8_t semaphore, uint32_t timeout) {
+    __asm(" SVC #0x1D");
+    return getR0();
+}
+
+//shared hold, returns IPC_OK, IPC_TIMEOUT or IPC_INVALID, read locks don't nest
+uint8_t readLock(uint8_t rwLock, uint32_t timeout) {
+    __asm(" SVC #0x24");
+    return getR0();
+}
+
+void readUnlock(uint8_t rwLock) {
+    __asm(" SVC #0x25");
+}
+
+//exclusive hold, returns IPC_OK, IPC_TIMEOUT or IPC_INVALID
+uint8_t writeLock(uint8_t rwLock, uint32_t timeout) {
+    __asm(" SVC #0x26");
+    return getR0();
+}
+
+void writeUnlock(uint8_t rwLock) {
+    __asm(" SVC #0x27");
+}
+
+//unlocks mutex and blocks until signaled, mutex is locked again when it returns
+//returns IPC_OK, or IPC_INVALID without blocking if the caller doesn't hold mutex
+uint8_t cond_wait(uint8_t cond, int8_t mutex) {
+    __asm(" SVC #0x28");
+    return getR0();
+}
+
+//wakes the highest priority waiter
+void cond_signal(uint8_t cond) {
+    __asm(" SVC #0x29");
+}
+
+void cond_broadcast(uint8_t cond) {
+    __asm(" SVC #0x2A");
+}
+
+//only called by fastLock and fastUnlock, not static so the mutex stays in R0
+void fastWait(uint8_t mutex) {
+    __asm(" SVC #0x22");
+}
+
+void fastWake(uint8_t mutex) {
+    __asm(" SVC #0x23");
+}
+
+//takes the word from unlocked to locked without a trap, otherwise marks it contended and sleeps
+//no owner is recorded, so there is no priority inheritance and kill does not release it
+void fastLock(uint8_t mutex) {
+    volatile uint32_t* word = &fastMutexes[mutex];
+    if (atomicCompareExchange(word, FAST_UNLOCKED, FAST_LOCKED) != FAST_UNLOCKED) {
+        while (atomicExchange(word, FAST_CONTENDED) != FAST_UNLOCKED) {
+            fastWait(mutex); //returns right away if it was unlocked in between
+        }
+    }
+}
+
+void fastUnlock(uint8_t mutex) {
+    if (atomicExchange(&fastMutexes[mutex], FAST_UNLOCKED) == FAST_CONTENDED) {
+        fastWake(mutex);
+    }
+}
+
+//copies size bytes (up to MAX_MESSAGE_SIZE) from the caller's memory or flash into the queue, returns IPC_OK, IPC_TIMEOUT or IPC_INVALID
+uint8_t send(uint8_t queue, const void* data, uint32_t size, uint32_t timeout) {
+    __asm(" SVC #0x16");
+    return getR0();
+}
+
+//zero copy send, buffer must be a block from malloc_from_heap, the caller can't touch it once this returns IPC_OK
+uint8_t sendBuffer(uint8_t queue, void* buffer, uint32_t size, uint32_t timeout) {
+    __asm(" SVC #0x17");
+    return getR0();
+}
+
+//msg->buffer is set for zero copy messages, the receiver owns that block from now on, IPC_INVALID if msg isn't in its memory
+uint8_t receive(uint8_t queue, message* msg, uint32_t timeout) {
+    __asm(" SVC #0x18");
+    return getR0();
+}
+
+void setEvents(uint8_t event, uint32_t bits) {
+    __asm(" SVC #0x19");
+}
+
+void clearEvents(uint8_t event, uint32_t bits) {
+    __asm(" SVC #0x1A");
+}
+
+//mode is EVENT_ANY or EVENT_ALL, optionally | EVENT_CLEAR
+//returns the bits of the mask that satisfied the wait, 0 on timeout
+uint32_t waitEvents(uint8_t event, uint32_t bits, uint8_t mode, uint32_t timeout) {
+    __asm(" SVC #0x1B");
+    return getR0();
+}
+
+//registers r (already set up by initRing) so ringWait can block on it, the caller is the consumer and r must be in its memory
+bool openRing(ringBuffer* r) {
+    __asm(" SVC #0x1E");
+    return getR0();
+}
+
+//blocks until r has data, returns IPC_OK, IPC_TIMEOUT or IPC_INVALID if r was never opened
+uint8_t ringWait(ringBuffer* r, uint32_t timeout) {
+    __asm(" SVC #0x1F");
+    return getR0();
+}
+
+//action is NOTIFY_SET_BITS, NOTIFY_INCREMENT or NOTIFY_OVERWRITE, returns false if fn is not a running task
+bool notify(_fn fn, uint32_t value, uint8_t action) {
+    __asm(" SVC #0x20");
+    return getR0();
+}
+
+//returns the notification value and clears clearBits of it (0xFFFFFFFF for a binary or counting signal)
+//returns 0 on timeout, so a notification should carry a non zero value
+uint32_t notifyWait(uint32_t clearBits, uint32_t timeout) {
+    __asm(" SVC #0x21");
+    return getR0();
+}
+
+//called by the producer isr after ringPut, the consumer is woken by the next pendsvIsr
+void ringSignalFromIsr(ringBuffer* r) {
+    uint8_t id = r->id;
+    __asm(" DMB"); //head was stored before the consumer is read
+    if (id < MAX_RINGS && ringConsumer[id] != INVALID_TASK) {
+        atomicOr(&ringWakeups, 1 << id);
+        NVIC_INT_CTRL_R = NVIC_INT_CTRL_PEND_SV;
+    }
+}
+
 uint32_t stopThread(_fn fn) {
     __asm(" SVC #0x0E");
     //return R0
@@ -368,76 +1830,141 @@ uint32_t restartThread(_fn fn) {
     //return R0
 }
 
-void setThreadPriority(_fn fn, uint8_t priority) {
+//KEEP_PRIORITY or a quantum of 0 leave that setting unchanged
+void setThreadPriority(_fn fn, uint8_t priority, uint32_t quantum) {
     __asm(" SVC #0x11");
 }
 
+void waitNextPeriod(void) {
+    __asm(" SVC #0x15");
+}
+
+void runBench(benchInfo* info, uint8_t bench) {
+    __asm(" SVC #0x13");
+}
+
 void* malloc_from_heap(uint32_t size) {
     __asm(" SVC #0x0F");
     void* addr = (void*)getR0();
     return addr;
 }
 
+//like malloc_from_heap but says why it failed, returns HEAP_OK, HEAP_NO_MEMORY, HEAP_OVER_QUOTA or HEAP_INVALID
+uint8_t try_malloc_from_heap(uint32_t size, void** ptr) {
+    __asm(" SVC #0x2E");
+    return getR0();
+}
+
+//returns false if ptr isn't a block from malloc_from_heap the caller owns, or it is queued in a zero copy message
+bool free_from_heap(void* ptr) {
+    __asm(" SVC #0x2D");
+    return getR0();
+}
+
+//block of up to 128 B from the caller's pool for its size class, NULL if that pool is full
+void* malloc_from_pool(uint32_t size) {
+    __asm(" SVC #0x2B");
+    void* addr = (void*)getR0();
+    return addr;
+}
+
+//returns false if ptr isn't a pool block the caller holds
+bool free_to_pool(void* ptr) {
+    __asm(" SVC #0x2C");
+    return getR0();
+}
+
 // REQUIRED: modify this function to add support for the system timer
 // REQUIRED: in preemptive code, add code to request task switch
 void sysTickIsr(void) {
-    //called every 1ms
+    //called every 1ms, or after several ticks in tickless mode
     //decrements task ticks and changes state from blocked or ready
-    systime++;
-    uint8_t is1sec = (systime % (PS_REFRESH_TIME*1000) == 0); //calculate mod once
+    uint32_t elapsed = tickStretch; //ticks covered by the period that just ended
+    uint32_t left = elapsed;
+    uint32_t lastSecond = systime / (PS_REFRESH_TIME*1000);
+    bool reschedule = false;
+    if (tickOneShot) {
+        //the wrap already reloaded the one-shot value, restart from one tick
+        //costs the isr entry latency, well under a microsecond, once per one-shot period
+        NVIC_ST_RELOAD_R = TICK_CYCLES - 1;
+        NVIC_ST_CURRENT_R = 0;
+        tickOneShot = false;
+    }
+    tickStretch = 1;
+    systime += elapsed;
+    uint8_t is1sec = (systime / (PS_REFRESH_TIME*1000) != lastSecond); //a stretched tick can jump past the boundary
     uint32_t i;
-    for(i = 0; i < taskCount; i++) {
-        if (tcb[i].state == STATE_DELAYED) {
-            if (tcb[i].ticks == 0) {
-                tcb[i].state = STATE_READY;
-            }
-            else {
-                tcb[i].ticks--;
-            }
+    uint8_t task;
+    //only the head of the sleep list is touched, tasks due on the same tick have a delta of 0
+    while (sleepHead != INVALID_TASK && tcb[sleepHead].ticks <= left) {
+        task = sleepHead;
+        left -= tcb[task].ticks;
+        sleepHead = tcb[task].sleepNext;
+        cancelWait(task); //timed out, its svc already returns IPC_TIMEOUT
+        setTaskState(task, STATE_READY); //pends a switch itself if the task preempts
+    }
+    if (sleepHead != INVALID_TASK) {
+        tcb[sleepHead].ticks -= left;
+    }
+    //charge the running job, once out of budget its deadline moves back a period so it can't starve the others
+    if (schedulerMode == SCHED_EDF && tcb[taskCurrent].period != 0 && tcb[taskCurrent].state == STATE_READY) {
+        if (tcb[taskCurrent].budget <= elapsed) {
+            tcb[taskCurrent].misses++;
+            startJob(taskCurrent, tcb[taskCurrent].release + tcb[taskCurrent].period);
+            reschedule = true; //another deadline may be earlier now
         }
-        if (tcb[i].state != STATE_INVALID) {
-            if (is1sec) {
-                tcb[i].elapsed[!pingpong] = 0; //if pingpong, write A, else write B
-            }
+        else {
+            tcb[taskCurrent].budget -= elapsed;
         }
     }
     if (is1sec) { //if 1000ms reached
+        for(i = 0; i < taskCount; i++) {
+            if (tcb[i].state != STATE_INVALID) {
+                tcb[i].elapsed[!pingpong] = 0; //if pingpong, write A, else write B
+            }
+        }
         pingpong ^= 1; //flip ping
     }
-    if (preemption) { //if preemption is enabled, context switch to next task
-        NVIC_INT_CTRL_R |= NVIC_INT_CTRL_PEND_SV;
+    //charge the quantum, only switch when it ran out and a peer is waiting for the cpu
+    if (tcb[taskCurrent].state == STATE_READY) {
+        if (tcb[taskCurrent].sliceLeft <= elapsed) {
+            tcb[taskCurrent].sliceLeft = 0;
+            reschedule |= timeSliceNeeded();
+        }
+        else {
+            tcb[taskCurrent].sliceLeft -= elapsed;
+        }
     }
-}
-
-// REQUIRED: in coop and preemptive, modify this function to add support for task switching
-// REQUIRED: process UNRUN and READY tasks differently
-__attribute__((naked)) void pendsvIsr(void) {
-    if (NVIC_FAULT_STAT_R & NVIC_FAULT_STAT_DERR) { //if data error
-        NVIC_FAULT_STAT_R |= NVIC_FAULT_STAT_DERR; //clear error bit
+    if (preemption) {
+        preemptTicks += elapsed;
+        if (reschedule) {
+            tickSwitches++;
+            NVIC_INT_CTRL_R |= NVIC_INT_CTRL_PEND_SV;
+        }
     }
-    if (NVIC_FAULT_STAT_R & NVIC_FAULT_STAT_IERR) { //if instruction error
-        NVIC_FAULT_STAT_R |= NVIC_FAULT_STAT_IERR; //clear error bit
+    if (ticklessMode) {
+        stretchTick();
     }
-    if (!firstTask) {
-        __asm(" MRS R0, PSP");
-        __asm(" SUB R0, R0, #4");
-        __asm(" STR LR, [R0]"); //store LR to stack
-        __asm(" MSR PSP, R0");
-        pushR4_R11(); //push regs
-        tcb[taskCurrent].sp = getPsp(); //save psp
+}
+
+// called once per switch by pendsvIsr (switch.s) after it pushed R4-R11 (and S16-S31) of the outgoing task
+// returns the incoming task's stack pointer in R0 and its EXC_RETURN in R1
+uint64_t taskSwitch(uint32_t* sp, uint32_t excReturn) {
+    if (!firstTask) { //the first switch comes from the startRtos stack, nothing to save
+        tcb[taskCurrent].sp = sp;
+        tcb[taskCurrent].excReturn = excReturn;
     }
     firstTask = 0;
+    if (ringWakeups != 0) {
+        wakeRingConsumers();
+        NVIC_INT_CTRL_R = NVIC_INT_CTRL_UNPEND_SV; //the scheduler below already sees the woken tasks
+    }
     tcb[taskCurrent].elapsed[pingpong] += (systime - tcb[taskCurrent].runtime);
     taskCurrent = rtosScheduler(); //call scheduler
     tcb[taskCurrent].runtime = systime; //records the starting time of the task
+    tcb[taskCurrent].sliceLeft = tcb[taskCurrent].quantum; //fresh quantum
     applySramAccessMask(tcb[taskCurrent].srd); //restore SRD
-    setPsp(tcb[taskCurrent].sp); //restore PSP
-    popR11_R4(); //restore all regs (R11-R4)
-    __asm(" MRS R0, PSP");
-    __asm(" LDR R14, [R0]"); //load LR from stack into R14
-    __asm(" ADD R0, R0, #4");
-    __asm(" MSR PSP, R0");
-    __asm(" BX LR"); //may not be necessary
+    return ((uint64_t)tcb[taskCurrent].excReturn << 32) | (uint32_t)tcb[taskCurrent].sp;
 }
 
 // REQUIRED: modify this function to add support for the service call
@@ -454,12 +1981,14 @@ void svCallIsr(void) {
      * R0   PSP + 0
      */
     uint32_t* psp = getPsp();
-    uint32_t* pc = (uint32_t*)(psp[6]);
-    uint8_t svcNum = ((uint8_t*)pc)[-2]; //sv call is 2 bytes behind pc
+    uint8_t svcNum = svcFromFrame(psp);
 
     uint8_t R0_8b = psp[0]; //first parameter of function calling svCall - uint8
     uint32_t R0_32b = psp[0]; //first parameter of function calling svCall - uint32
     uint8_t R1_8b = psp[1];
+    uint32_t R1_32b = psp[1];
+    uint32_t R2_32b = psp[2];
+    uint32_t R3_32b = psp[3];
 
     psInfo* psinfo = (psInfo*)psp[0]; //used in ps
     const char* str = (const char*)psp[0]; //used in pidof
@@ -467,8 +1996,11 @@ void svCallIsr(void) {
     memInfo* minfo = (memInfo*)psp[0];
 
     uint8_t next, q, prio;
-    uint32_t i, j, tick, pid, size;
+    uint32_t i, j, k, tick, pid, size, quantum, match, timeout;
     void* mallocAddr;
+    alloc_entry* block;
+    ringBuffer* r;
+    bool ok, write;
     switch (svcNum) {
     case SVC_START: //start OS
         NVIC_INT_CTRL_R |= NVIC_INT_CTRL_PEND_SV;
@@ -478,81 +2010,350 @@ void svCallIsr(void) {
         break;
     case SVC_SLEEP: //sleep
         tick = R0_32b;
-        tcb[taskCurrent].ticks = tick;
-        tcb[taskCurrent].state = STATE_DELAYED;
+        setTaskState(taskCurrent, STATE_DELAYED); //ends any stretched tick first
+        sleepInsert(taskCurrent, tick + tickStretch); //wakes on the (tick + 1)th tick, deltas count from the last tick isr
         NVIC_INT_CTRL_R |= NVIC_INT_CTRL_PEND_SV;
         break;
     case SVC_LOCK: //lock mutex i
+    case SVC_LOCKTIMEOUT:
         i = R0_8b;
-        tcb[taskCurrent].mutex = i;
-        if (!mutexes[i].lock) {
+        timeout = (svcNum == SVC_LOCK) ? WAIT_FOREVER : R1_32b;
+        psp[0] = IPC_OK;
+        if (mutexes[i].ceiling != NO_CEILING && tcb[taskCurrent].priority < mutexes[i].ceiling) {
+            psp[0] = IPC_INVALID; //ceiling is below this task's base priority, icpp can't hold for it
+        }
+        else if (!mutexes[i].lock) {
+            tcb[taskCurrent].mutex = i;
             mutexes[i].lock = 1;
             mutexes[i].lockedBy = taskCurrent;
+            if (mutexes[i].ceiling != NO_CEILING) {
+                updatePriorityChain(taskCurrent); //raise to the ceiling right away, nothing that uses it can preempt us
+            }
+        }
+        else if (timeout == NO_WAIT) {
+            psp[0] = IPC_TIMEOUT;
         }
         else {
-            q = mutexes[i].queueSize;
-            mutexes[i].processQueue[q] = taskCurrent;
-            mutexes[i].queueSize++;
-            tcb[taskCurrent].state = STATE_BLOCKED_MUTEX;
+            tcb[taskCurrent].mutex = i;
+            waitInsert(&mutexes[i].waiters, taskCurrent);
+            tcb[taskCurrent].blockedSince = systime;
+            tcb[taskCurrent].frame = psp;
+            psp[0] = IPC_TIMEOUT; //releaseMutex overwrites this if the lock is handed over in time
+            setTaskState(taskCurrent, STATE_BLOCKED_MUTEX);
+            updatePriorityChain(mutexes[i].lockedBy); //owner and everyone it waits on inherit our priority
+            startTimeout(taskCurrent, timeout);
             NVIC_INT_CTRL_R |= NVIC_INT_CTRL_PEND_SV;
         }
         break;
     case SVC_UNLOCK: //unlock mutex i
         i = R0_8b;
-        if (mutexes[i].lockedBy == taskCurrent) {
-            mutexes[i].lock = 0;
+        if (mutexes[i].lock && mutexes[i].lockedBy == taskCurrent) {
             tcb[taskCurrent].mutex = INVALID_MUTEX;
-            if (mutexes[i].queueSize > 0) {
-                next = mutexes[i].processQueue[0]; //get next task in mutex queue
-
-                dequeue(mutexes[i].processQueue, mutexes[i].queueSize, 0); //remove next task from queue
-                mutexes[i].queueSize--;
-
-                //next task locks mutex
-                mutexes[i].lock = 1;
-                mutexes[i].lockedBy = next;
-                tcb[next].mutex = i;
-                tcb[next].state = STATE_READY;
-            }
+            releaseMutex(i);
         }
         break;
     case SVC_WAIT:
+    case SVC_WAITTIMEOUT:
         i = R0_8b;
-        tcb[taskCurrent].semaphore = i;
+        timeout = (svcNum == SVC_WAIT) ? WAIT_FOREVER : R1_32b;
+        psp[0] = IPC_OK;
         if (semaphores[i].count > 0) {
+            tcb[taskCurrent].semaphore = i;
             semaphores[i].count--;
         }
+        else if (timeout == NO_WAIT) {
+            psp[0] = IPC_TIMEOUT;
+        }
         else {
-            semaphores[i].processQueue[semaphores[i].queueSize++] = taskCurrent;
-            tcb[taskCurrent].state = STATE_BLOCKED_SEMAPHORE;
+            tcb[taskCurrent].semaphore = i;
+            waitInsert(&semaphores[i].waiters, taskCurrent);
+            tcb[taskCurrent].frame = psp;
+            psp[0] = IPC_TIMEOUT; //post overwrites this if it wakes the task in time
+            setTaskState(taskCurrent, STATE_BLOCKED_SEMAPHORE);
+            startTimeout(taskCurrent, timeout);
             NVIC_INT_CTRL_R |= NVIC_INT_CTRL_PEND_SV;
         }
         break;
     case SVC_POST:
         i = R0_8b;
-        semaphores[i].count++;
         tcb[taskCurrent].semaphore = INVALID_SEMAPHORE;
-        if (semaphores[i].queueSize > 0) {
-            next = semaphores[i].processQueue[0];
-
-            dequeue(semaphores[i].processQueue, semaphores[i].queueSize, 0);
-            semaphores[i].queueSize--;
-
-            semaphores[i].count--;
-            tcb[next].state = STATE_READY;
+        semaphorePost(i);
+        break;
+    case SVC_SEND:
+    case SVC_SENDBUFFER:
+        q = R0_8b;
+        size = R2_32b;
+        if (svcNum == SVC_SEND) {
+            ok = (size <= MAX_MESSAGE_SIZE && taskCanRead(taskCurrent, (void*)psp[1], size));
+        }
+        else {
+            block = ownedBlock(taskCurrent, (void*)psp[1]);
+            ok = (block != NULL && size <= block->size && !queuedBuffer(block->ptr)); //ownership only moves at queueGet, so a second send would be taken
+        }
+        if (q >= MAX_QUEUES || !ok) {
+            psp[0] = IPC_INVALID;
+        }
+        else if (queues[q].count < MAX_QUEUE_MESSAGES) {
+            queuePut(q, taskCurrent, psp);
+            psp[0] = IPC_OK;
+            if (queues[q].waiters.head != INVALID_TASK) { //a receiver is waiting on the empty queue
+                next = waitPop(&queues[q].waiters);
+                queueGet(q, next, (message*)tcb[next].frame[1]);
+                wakeWaiter(next, IPC_OK);
+            }
+        }
+        else {
+            blockOnQueue(q, R3_32b, psp);
+        }
+        break;
+    case SVC_RECEIVE:
+        q = R0_8b;
+        if (q >= MAX_QUEUES || !taskCanWrite(taskCurrent, (void*)psp[1], sizeof(message))) {
+            psp[0] = IPC_INVALID;
+        }
+        else if (queues[q].count > 0) {
+            queueGet(q, taskCurrent, (message*)psp[1]);
+            psp[0] = IPC_OK;
+            if (queues[q].waiters.head != INVALID_TASK) { //a sender is waiting on the full queue
+                next = waitPop(&queues[q].waiters);
+                queuePut(q, next, tcb[next].frame);
+                wakeWaiter(next, IPC_OK);
+            }
+        }
+        else {
+            blockOnQueue(q, R2_32b, psp);
+        }
+        break;
+    case SVC_SETEVENTS:
+        i = R0_8b;
+        if (i < MAX_EVENTS) {
+            eventsSet(i, R1_32b);
+        }
+        break;
+    case SVC_CLEAREVENTS:
+        i = R0_8b;
+        if (i < MAX_EVENTS) {
+            events[i].flags &= ~R1_32b;
+        }
+        break;
+    case SVC_WAITEVENTS:
+        i = R0_8b;
+        psp[0] = 0; //timed out or invalid
+        if (i < MAX_EVENTS) {
+            match = eventMatch(events[i].flags, R1_32b, R2_32b);
+            if (match != 0) {
+                psp[0] = match;
+                if (R2_32b & EVENT_CLEAR) {
+                    events[i].flags &= ~match;
+                }
+            }
+            else if (R3_32b != NO_WAIT) {
+                tcb[taskCurrent].frame = psp;
+                tcb[taskCurrent].event = i;
+                waitInsert(&events[i].waiters, taskCurrent);
+                setTaskState(taskCurrent, STATE_BLOCKED_EVENT);
+                startTimeout(taskCurrent, R3_32b);
+                NVIC_INT_CTRL_R |= NVIC_INT_CTRL_PEND_SV;
+            }
+        }
+        break;
+    case SVC_OPENRING:
+        r = (ringBuffer*)R0_32b;
+        psp[0] = false;
+        for (i = 0; i < MAX_RINGS && !psp[0] && taskCanWrite(taskCurrent, r, sizeof(ringBuffer)); i++) {
+            if (rings[i] == NULL) {
+                rings[i] = r;
+                ringOwner[i] = taskCurrent;
+                ringConsumer[i] = INVALID_TASK;
+                r->id = i;
+                psp[0] = true;
+            }
+        }
+        break;
+    case SVC_RINGWAIT:
+        r = (ringBuffer*)R0_32b;
+        timeout = R1_32b;
+        if (!taskCanWrite(taskCurrent, r, sizeof(ringBuffer)) || r->id >= MAX_RINGS || rings[r->id] != r
+                || (ringOwner[r->id] != taskCurrent && ringConsumer[r->id] != taskCurrent)) {
+            psp[0] = IPC_INVALID; //only the consumer that opened it may block on it
+        }
+        else {
+            //publish the waiter before looking at head, so a producer that runs in between is either seen here or sees us
+            ringConsumer[r->id] = taskCurrent;
+            __asm(" DMB");
+            if (r->head != r->tail) {
+                ringConsumer[r->id] = INVALID_TASK;
+                psp[0] = IPC_OK;
+            }
+            else if (timeout == NO_WAIT) {
+                ringConsumer[r->id] = INVALID_TASK;
+                psp[0] = IPC_TIMEOUT;
+            }
+            else {
+                tcb[taskCurrent].frame = psp;
+                psp[0] = IPC_TIMEOUT;
+                setTaskState(taskCurrent, STATE_BLOCKED_RING);
+                startTimeout(taskCurrent, timeout);
+                NVIC_INT_CTRL_R |= NVIC_INT_CTRL_PEND_SV;
+            }
+        }
+        break;
+    case SVC_NOTIFY:
+        i = taskFromPid(R0_32b);
+        psp[0] = false;
+        if (i != INVALID_TASK && tcb[i].state != STATE_STOPPED) {
+            if (R2_32b == NOTIFY_INCREMENT) {
+                tcb[i].notifyValue++;
+            }
+            else if (R2_32b == NOTIFY_OVERWRITE) {
+                tcb[i].notifyValue = R1_32b;
+            }
+            else {
+                tcb[i].notifyValue |= R1_32b;
+            }
+            tcb[i].notifyPending = true;
+            if (tcb[i].state == STATE_BLOCKED_NOTIFY) {
+                wakeWaiter(i, notifyTake(i, tcb[i].notifyClear)); //no wait list, the target is woken directly
+            }
+            psp[0] = true;
+        }
+        break;
+    case SVC_NOTIFYWAIT:
+        timeout = R1_32b;
+        if (tcb[taskCurrent].notifyPending) {
+            psp[0] = notifyTake(taskCurrent, R0_32b);
+        }
+        else {
+            psp[0] = 0; //timed out
+            if (timeout != NO_WAIT) {
+                tcb[taskCurrent].notifyClear = R0_32b;
+                tcb[taskCurrent].frame = psp;
+                setTaskState(taskCurrent, STATE_BLOCKED_NOTIFY);
+                startTimeout(taskCurrent, timeout);
+                NVIC_INT_CTRL_R |= NVIC_INT_CTRL_PEND_SV;
+            }
+        }
+        break;
+    case SVC_FASTWAIT: //the svc can't be interrupted by the holder, so the check and the block are atomic
+        i = R0_8b;
+        if (i < MAX_FAST_MUTEXES && fastMutexes[i] == FAST_CONTENDED) {
+            tcb[taskCurrent].fastMutex = i;
+            tcb[taskCurrent].frame = psp;
+            waitInsert(&fastWaiters[i], taskCurrent);
+            setTaskState(taskCurrent, STATE_BLOCKED_FAST);
+            NVIC_INT_CTRL_R |= NVIC_INT_CTRL_PEND_SV;
+        }
+        break;
+    case SVC_FASTWAKE: //the woken task retries the word, marking it contended for anyone left behind it
+        i = R0_8b;
+        if (i < MAX_FAST_MUTEXES && fastWaiters[i].head != INVALID_TASK) {
+            next = waitPop(&fastWaiters[i]);
+            wakeWaiter(next, IPC_OK);
+        }
+        break;
+    case SVC_READLOCK:
+    case SVC_WRITELOCK:
+        i = R0_8b;
+        timeout = R1_32b;
+        write = (svcNum == SVC_WRITELOCK);
+        if (i >= MAX_RWLOCKS || rwLocks[i].writer == taskCurrent || (tcb[taskCurrent].readLocks & (1 << i))) {
+            psp[0] = IPC_INVALID; //already held, it would wait on itself
+        }
+        else if (write && rwLocks[i].writer == INVALID_TASK && rwLocks[i].readers == 0) {
+            rwLocks[i].writer = taskCurrent;
+            psp[0] = IPC_OK;
+        }
+        else if (!write && rwLocks[i].writer == INVALID_TASK && rwLocks[i].writeWaiters.head == INVALID_TASK) {
+            rwLocks[i].readers++;
+            tcb[taskCurrent].readLocks |= 1 << i;
+            psp[0] = IPC_OK;
+        }
+        else if (timeout == NO_WAIT) {
+            psp[0] = IPC_TIMEOUT;
+        }
+        else {
+            tcb[taskCurrent].rwLock = i;
+            tcb[taskCurrent].frame = psp;
+            psp[0] = IPC_TIMEOUT; //rwGrant overwrites this if the lock is granted in time
+            waitInsert(write ? &rwLocks[i].writeWaiters : &rwLocks[i].readWaiters, taskCurrent);
+            setTaskState(taskCurrent, write ? STATE_BLOCKED_WRITE : STATE_BLOCKED_READ);
+            startTimeout(taskCurrent, timeout);
+            NVIC_INT_CTRL_R |= NVIC_INT_CTRL_PEND_SV;
+        }
+        break;
+    case SVC_READUNLOCK:
+        i = R0_8b;
+        if (i < MAX_RWLOCKS && (tcb[taskCurrent].readLocks & (1 << i))) {
+            tcb[taskCurrent].readLocks &= ~(1 << i);
+            rwLocks[i].readers--;
+            rwGrant(i);
+        }
+        break;
+    case SVC_WRITEUNLOCK:
+        i = R0_8b;
+        if (i < MAX_RWLOCKS && rwLocks[i].writer == taskCurrent) {
+            rwLocks[i].writer = INVALID_TASK;
+            rwGrant(i);
+        }
+        break;
+    case SVC_CONDWAIT:
+        i = R0_8b;
+        q = R1_8b;
+        if (i >= MAX_CONDS || q >= MAX_MUTEXES || !mutexes[q].lock || mutexes[q].lockedBy != taskCurrent) {
+            psp[0] = IPC_INVALID;
+        }
+        else {
+            tcb[taskCurrent].cond = i;
+            tcb[taskCurrent].mutex = q; //to take back once signaled
+            tcb[taskCurrent].frame = psp;
+            psp[0] = IPC_OK;
+            waitInsert(&conds[i].waiters, taskCurrent);
+            setTaskState(taskCurrent, STATE_BLOCKED_COND);
+            releaseMutex(q);
+            NVIC_INT_CTRL_R |= NVIC_INT_CTRL_PEND_SV;
+        }
+        break;
+    case SVC_CONDSIGNAL:
+        i = R0_8b;
+        if (i < MAX_CONDS && conds[i].waiters.head != INVALID_TASK) {
+            next = waitPop(&conds[i].waiters);
+            condRequeue(next);
+        }
+        break;
+    case SVC_CONDBROADCAST:
+        i = R0_8b;
+        while (i < MAX_CONDS && conds[i].waiters.head != INVALID_TASK) {
+            next = waitPop(&conds[i].waiters);
+            condRequeue(next);
         }
         break;
     case SVC_PRIO:
         i = R0_8b;
-        priorityScheduler = i;
+        if (i == SCHED_RR || i == SCHED_PRIO || i == SCHED_EDF) {
+            schedulerMode = i;
+            tickResume();
+        }
         break;
-    /*case SVC_PI:
+    case SVC_PI:
         i = R0_8b;
         priorityInheritance = i;
-        break;*/
+        for (j = 0; j < MAX_TASKS; j++) {
+            if (tcb[j].state != STATE_INVALID) {
+                updatePriorityChain(j);
+            }
+        }
+        break;
     case SVC_PREEMPTION:
         i = R0_8b;
         preemption = i;
+        tickResume();
+        break;
+    case SVC_TICKLESS:
+        i = R0_8b;
+        if (i <= true) {
+            ticklessMode = i;
+            tickResume();
+        }
         break;
     case SVC_PS:
         for (i = 0; i < taskCount; i++) {
@@ -561,12 +2362,39 @@ void svCallIsr(void) {
             psinfo[i].runtime = tcb[i].elapsed[!pingpong];
             psinfo[i].state = tcb[i].state;
             psinfo[i].prio = tcb[i].priority;
+            psinfo[i].misses = tcb[i].misses;
+            psinfo[i].quantum = tcb[i].quantum;
+            psinfo[i].stackSize = tcb[i].stackSize;
+            psinfo[i].stackPeak = (tcb[i].state != STATE_STOPPED) ? stackPeak(i) : 0; //a stopped task's stack is back on the heap
             if (tcb[i].state == STATE_BLOCKED_MUTEX) {
                 psinfo[i].mutex_or_sem = tcb[i].mutex;
             }
             else if (tcb[i].state == STATE_BLOCKED_SEMAPHORE) {
                 psinfo[i].mutex_or_sem = tcb[i].semaphore;
             }
+            else if (tcb[i].state == STATE_BLOCKED_QUEUE) {
+                psinfo[i].mutex_or_sem = tcb[i].queue;
+            }
+            else if (tcb[i].state == STATE_BLOCKED_EVENT) {
+                psinfo[i].mutex_or_sem = tcb[i].event;
+            }
+            else if (tcb[i].state == STATE_BLOCKED_FAST) {
+                psinfo[i].mutex_or_sem = tcb[i].fastMutex;
+            }
+            else if (tcb[i].state == STATE_BLOCKED_READ || tcb[i].state == STATE_BLOCKED_WRITE) {
+                psinfo[i].mutex_or_sem = tcb[i].rwLock;
+            }
+            else if (tcb[i].state == STATE_BLOCKED_COND) {
+                psinfo[i].mutex_or_sem = tcb[i].cond;
+            }
+            else if (tcb[i].state == STATE_BLOCKED_RING) {
+                psinfo[i].mutex_or_sem = 0xFF;
+                for (j = 0; j < MAX_RINGS; j++) {
+                    if (ringConsumer[j] == i) {
+                        psinfo[i].mutex_or_sem = j;
+                    }
+                }
+            }
             else {
                 psinfo[i].mutex_or_sem = 0xFF;
             }
@@ -582,18 +2410,38 @@ void svCallIsr(void) {
             }
         }
         for (i = 0; i < MAX_MUTEXES; i++) {
-            ipcsinfo->mutexes[i].lock = mutexes[i].lock;
-            ipcsinfo->mutexes[i].queueSize = mutexes[i].queueSize;
-            for (j = 0; j < MAX_MUTEX_QUEUE_SIZE; j++) {
-                ipcsinfo->mutexes[i].processQueue[j] = mutexes[i].processQueue[j];
-            }
-            ipcsinfo->mutexes[i].lockedBy = mutexes[i].lockedBy;
+            ipcsinfo->mutexes[i] = mutexes[i];
+            copyWaitList(&mutexes[i].waiters, ipcsinfo->mutexWaiters[i]);
         }
         for (i = 0; i < MAX_SEMAPHORES; i++) {
-            ipcsinfo->semaphores[i].count = semaphores[i].count;
-            ipcsinfo->semaphores[i].queueSize = semaphores[i].queueSize;
-            for (j = 0; j < MAX_MUTEX_QUEUE_SIZE; j++) {
-                ipcsinfo->semaphores[i].processQueue[j] = semaphores[i].processQueue[j];
+            ipcsinfo->semaphores[i] = semaphores[i];
+            copyWaitList(&semaphores[i].waiters, ipcsinfo->semaphoreWaiters[i]);
+        }
+        for (i = 0; i < MAX_QUEUES; i++) {
+            ipcsinfo->queueCount[i] = queues[i].count;
+            ipcsinfo->queueSize[i] = queues[i].waiters.size;
+            copyWaitList(&queues[i].waiters, ipcsinfo->queueWaiters[i]);
+        }
+        for (i = 0; i < MAX_EVENTS; i++) {
+            ipcsinfo->events[i] = events[i];
+            copyWaitList(&events[i].waiters, ipcsinfo->eventWaiters[i]);
+        }
+        for (i = 0; i < MAX_RWLOCKS; i++) {
+            ipcsinfo->rwLocks[i] = rwLocks[i];
+            k = 0;
+            for (j = 0; j < MAX_TASKS; j++) {
+                if (tcb[j].state != STATE_INVALID && (tcb[j].readLocks & (1 << i))) {
+                    ipcsinfo->rwReaders[i][k++] = j;
+                }
+            }
+            copyWaitList(&rwLocks[i].readWaiters, ipcsinfo->rwReadWaiters[i]);
+            copyWaitList(&rwLocks[i].writeWaiters, ipcsinfo->rwWriteWaiters[i]);
+        }
+        for (i = 0; i < MAX_CONDS; i++) {
+            ipcsinfo->conds[i] = conds[i];
+            copyWaitList(&conds[i].waiters, ipcsinfo->condWaiters[i]);
+            for (j = 0; j < conds[i].waiters.size; j++) {
+                ipcsinfo->condMutex[i][j] = tcb[ipcsinfo->condWaiters[i][j]].mutex;
             }
         }
     case SVC_PIDOF:
@@ -607,13 +2455,37 @@ void svCallIsr(void) {
     case SVC_MEMINFO:
         //print stuff in Alloctable
         for (i = 0; i < MAX_ALLOCS; i++) {
-            uint32_t o = allocTable[i].owner; //owner does not get set when creating thread, fix this
+            uint32_t o = allocTable[i].owner;
             if (allocTable[i].valid) {
-                minfo[i].valid = true;
-                minfo[i].baseAdd = allocTable[i].ptr;
-                str_copy(minfo[i].ownerName, tcb[o].name);// = allocTable[i].owner;
-                minfo[i].size = allocTable[i].size;
-                minfo[i].usage = (1000*((uint32_t)tcb[o].spInit - (uint32_t)tcb[o].sp))/(tcb[o].stackSize);
+                minfo->allocs[i].valid = true;
+                minfo->allocs[i].baseAdd = allocTable[i].ptr;
+                str_copy(minfo->allocs[i].ownerName, tcb[o].name);// = allocTable[i].owner;
+                minfo->allocs[i].size = allocTable[i].size;
+                minfo->allocs[i].stack = ((uint8_t*)allocTable[i].ptr == stackBlock(o));
+                if (minfo->allocs[i].stack) {
+                    minfo->allocs[i].guard = tcb[o].guardSize;
+                    minfo->allocs[i].usage = (1000*stackPeak(o))/(tcb[o].stackSize);
+                }
+            }
+        }
+        for (i = 0; i < MAX_POOLS; i++) {
+            if (pools[i].base != NULL) {
+                minfo->pools[i].valid = true;
+                minfo->pools[i].baseAdd = pools[i].base;
+                str_copy(minfo->pools[i].ownerName, tcb[pools[i].owner].name);
+                minfo->pools[i].blockSize = pools[i].blockSize;
+                minfo->pools[i].blocks = POOL_BYTES / pools[i].blockSize;
+                minfo->pools[i].used = pools[i].used;
+                minfo->pools[i].peak = pools[i].peak;
+            }
+        }
+        for (i = 0; i < MAX_TASKS; i++) {
+            if (tcb[i].state != STATE_INVALID) {
+                minfo->quotas[i].valid = true;
+                str_copy(minfo->quotas[i].name, tcb[i].name);
+                minfo->quotas[i].quota = tcb[i].heapQuota;
+                minfo->quotas[i].used = tcb[i].heapUsed;
+                minfo->quotas[i].peak = tcb[i].heapPeak;
             }
         }
         break;
@@ -623,37 +2495,54 @@ void svCallIsr(void) {
         break;
     case SVC_MALLOC:
         size = R0_32b;
-        mallocAddr = malloc_(size);
-        addSramAccessWindow(&tcb[taskCurrent].srd, (uint32_t*)mallocAddr, size); //add the new malloc into the task's srd
-        applySramAccessMask(tcb[taskCurrent].srd); //apply the srd to the CPU until next context switch
+        heapMalloc(size, &mallocAddr);
         psp[0] = (uint32_t*)mallocAddr;
         break;
+    case SVC_TRYMALLOC:
+        psp[0] = HEAP_INVALID;
+        if (taskCanWrite(taskCurrent, (void*)R1_32b, sizeof(void*))) {
+            psp[0] = heapMalloc(R0_32b, (void**)R1_32b);
+        }
+        break;
+    case SVC_FREE:
+        block = ownedBlock(taskCurrent, (void*)R0_32b);
+        psp[0] = false;
+        if (block != NULL && !queuedBuffer(block->ptr)) {
+            removeSramAccessWindow(&tcb[taskCurrent].srd, (uint32_t*)block->ptr, block->size);
+            applySramAccessMask(tcb[taskCurrent].srd);
+            chargeHeap(taskCurrent, block, false);
+            free_to_heap(block->ptr);
+            psp[0] = true;
+        }
+        break;
+    case SVC_POOLALLOC:
+        i = poolClass(R0_32b);
+        psp[0] = 0;
+        if (R0_32b != 0 && i < POOL_CLASSES) {
+            if (tcb[taskCurrent].pools[i] == INVALID_POOL && tcb[taskCurrent].heapUsed + POOL_BYTES <= tcb[taskCurrent].heapQuota) {
+                //first block of this size, carve a subregion charged to the quota and open it to the task
+                tcb[taskCurrent].pools[i] = createPool(POOL_MIN_BLOCK << i, taskCurrent);
+                if (tcb[taskCurrent].pools[i] != INVALID_POOL) {
+                    chargeHeap(taskCurrent, findAlloc(pools[tcb[taskCurrent].pools[i]].base), true);
+                    addSramAccessWindow(&tcb[taskCurrent].srd, (uint32_t*)pools[tcb[taskCurrent].pools[i]].base, POOL_BYTES);
+                    applySramAccessMask(tcb[taskCurrent].srd);
+                }
+            }
+            if (tcb[taskCurrent].pools[i] != INVALID_POOL) {
+                psp[0] = (uint32_t)poolAlloc(tcb[taskCurrent].pools[i]);
+            }
+        }
+        break;
+    case SVC_POOLFREE:
+        psp[0] = poolFree((void*)R0_32b, taskCurrent);
+        break;
     case SVC_RESTARTTHREAD:
         pid = R0_32b;
         i = taskFromPid(pid);
         psp[0] = 1; //return status code
         if (i != INVALID_TASK) {
             if (tcb[i].state == STATE_STOPPED) {
-                uint8_t* alloc = malloc_(tcb[i].stackSize); //returns base addr (bottom)
-                if (alloc != NULL) {
-                    uint32_t k;
-                    for (k = 0; k < MAX_ALLOCS; k++) {
-                        if (allocTable[k].ptr == alloc) {
-                            allocTable[k].owner = i;
-                        }
-                    }
-                    uint32_t* sp = (uint32_t*)(alloc + tcb[i].stackSize);//tcb[i].spInit; //set stack ptr to top of region bc stack decrement
-                    tcb[i].spInit = sp; //set initial stack pointer to stack base
-                    tcb[i].sp = sp; //set stack pointer to stack base (stack pointer decrements on push)
-                    populateInitialStack((uint32_t**)&tcb[i].sp, (uint32_t**)pid); //push everything onto the stack to make it appear as if it has ran before
-                    uint64_t taskSrd = createNoSramAccessMask(); //create mask for no sram access
-                    addSramAccessWindow(&taskSrd, (uint32_t*)(tcb[i].spInit-tcb[i].stackSize), tcb[i].stackSize); //modify srd mask to add access to malloc'd region
-                    tcb[i].srd = taskSrd; //set task srd to newly created srd
-                    tcb[i].state = STATE_READY; //set task state to ready
-                    tcb[i].semaphore = INVALID_SEMAPHORE;
-                    tcb[i].mutex = INVALID_MUTEX;
-                }
-                else {
+                if (!restartTask(i)) {
                     //malloc could not find space
                     psp[0] = 0; //RETURN ERROR_INSUFFICIENT_MEMORY
                 }
@@ -672,9 +2561,35 @@ void svCallIsr(void) {
     case SVC_SETPRIORITY:
         pid = R0_32b;
         prio = R1_8b;
+        quantum = R2_32b;
         i = taskFromPid(pid);
         if (i != INVALID_TASK) {
-            tcb[i].priority = prio;
+            if (quantum != 0) {
+                tcb[i].quantum = quantum;
+            }
+            if (prio != KEEP_PRIORITY) {
+                tcb[i].priority = prio;
+                updatePriorityChain(i);
+            }
+        }
+        break;
+    case SVC_BENCH:
+        runKernelBench(R1_8b, (benchInfo*)R0_32b);
+        break;
+    case SVC_PERIOD:
+        //job done, sleep until the next release
+        i = taskCurrent;
+        if (tcb[i].period != 0) {
+            tick = tickNow(); //in tickless mode systime can be a whole stretch behind
+            if ((int32_t)(tick - tcb[i].absDeadline) > 0) {
+                tcb[i].misses++;
+            }
+            startJob(i, tcb[i].release + tcb[i].period);
+            if ((int32_t)(tcb[i].release - tick) > 0) {
+                setTaskState(i, STATE_DELAYED);
+                sleepInsert(i, tcb[i].release - systime); //deltas count from the last tick isr, which set systime
+            }
+            NVIC_INT_CTRL_R |= NVIC_INT_CTRL_PEND_SV;
         }
         break;
     case SVC_REBOOT:
@@ -57,24 +57,24 @@ int main(void) {
     // Setup UART0 baud rate
     setUart0BaudRate(115200, 40e6);
 
-    // Initialize mutexes and semaphores
-    initMutex(resource);
-    initSemaphore(keyPressed, 1);
-    initSemaphore(keyReleased, 0);
+    // Initialize mutexes, semaphores and event flags
+    initMutex(resource, NO_CEILING);
+    initMutex(benchMutex, NO_CEILING);
     initSemaphore(flashReq, 5);
+    initEvents(keyEvents, KEY_PRESSED);
 
-    ok = createThread(idle, "Idle", 15, 512);
+    ok = createThread(idle, "Idle", 15, 512, DEFAULT_QUANTUM, 0);
 
     // Add other processes
-    ok &= createThread(lengthyFn, "LengthyFn", 12, 1024);
-    ok &= createThread(flash4Hz, "Flash4Hz", 8, 512);
-    ok &= createThread(oneshot, "OneShot", 4, 1536);
-    ok &= createThread(readKeys, "ReadKeys", 12, 1024);
-    ok &= createThread(debounce, "Debounce", 12, 1024);
-    ok &= createThread(important, "Important", 0, 1024);
-    ok &= createThread(uncooperative, "Uncoop", 12, 1024);
-    ok &= createThread(errant, "Errant", 12, 512);
-    ok &= createThread(shell, "Shell", 12, 4096);
+    ok &= createThread(lengthyFn, "LengthyFn", 12, 1024, DEFAULT_QUANTUM, 5120); // one 5000 B buffer at a time
+    ok &= createThread(flash4Hz, "Flash4Hz", 8, 512, DEFAULT_QUANTUM, 0);
+    ok &= createThread(oneshot, "OneShot", 4, 1536, DEFAULT_QUANTUM, 0);
+    ok &= createThread(readKeys, "ReadKeys", 12, 1024, DEFAULT_QUANTUM, 0);
+    ok &= createThread(debounce, "Debounce", 12, 1024, DEFAULT_QUANTUM, 0);
+    ok &= createThread(important, "Important", 0, 1024, DEFAULT_QUANTUM, 0);
+    ok &= createThread(uncooperative, "Uncoop", 12, 1024, DEFAULT_QUANTUM, 0);
+    ok &= createThread(errant, "Errant", 12, 512, DEFAULT_QUANTUM, 0);
+    ok &= createThread(shell, "Shell", 12, 4096, DEFAULT_QUANTUM, 0);
 
     // Start up RTOS
     if (ok)
@@ -4,6 +4,7 @@
 #include "shell.h"
 #include "kernel.h"
 #include "mm.h"
+#include "tasks.h"
 
 void ps() {
     //putsUart0("PS called\n");
@@ -16,7 +17,7 @@ void ps() {
      *
      *
      */
-    putsUart0("|-i-|--PID--|---Name---|--CPU Time%--|--Prio--|------State------|--Semaphore/Mutex--|\n");
+    putsUart0("|-i-|--PID--|---Name---|--CPU Time%--|--Prio--|------State------|--Semaphore/Mutex--|--Misses--|--Stack--|--Peak--|--Quantum--|\n");
     uint8_t i;
     uint32_t percent;
     for (i = 0; i < MAX_TASKS; i++) {
@@ -52,30 +53,72 @@ void ps() {
                 padded_putsUart0("BLOCKED_SEMAPHORE", 18);
                 padded_putdUart0(taskInfo[i].mutex_or_sem, 18);
                 break;
+            case STATE_BLOCKED_QUEUE:
+                padded_putsUart0("BLOCKED_QUEUE", 18);
+                padded_putdUart0(taskInfo[i].mutex_or_sem, 18);
+                break;
+            case STATE_BLOCKED_EVENT:
+                padded_putsUart0("BLOCKED_EVENT", 18);
+                padded_putdUart0(taskInfo[i].mutex_or_sem, 18);
+                break;
+            case STATE_BLOCKED_RING:
+                padded_putsUart0("BLOCKED_RING", 18);
+                padded_putdUart0(taskInfo[i].mutex_or_sem, 18);
+                break;
+            case STATE_BLOCKED_FAST:
+                padded_putsUart0("BLOCKED_FAST", 18);
+                padded_putdUart0(taskInfo[i].mutex_or_sem, 18);
+                break;
+            case STATE_BLOCKED_READ:
+                padded_putsUart0("BLOCKED_READ", 18);
+                padded_putdUart0(taskInfo[i].mutex_or_sem, 18);
+                break;
+            case STATE_BLOCKED_WRITE:
+                padded_putsUart0("BLOCKED_WRITE", 18);
+                padded_putdUart0(taskInfo[i].mutex_or_sem, 18);
+                break;
+            case STATE_BLOCKED_COND:
+                padded_putsUart0("BLOCKED_COND", 18);
+                padded_putdUart0(taskInfo[i].mutex_or_sem, 18);
+                break;
+            case STATE_BLOCKED_NOTIFY:
+                padded_putsUart0("BLOCKED_NOTIFY", 18);
+                padded_putsUart0(" ", 18);
+                break;
             }
+            padded_putdUart0(taskInfo[i].misses, 11);
+            padded_putdUart0(taskInfo[i].stackSize, 10);
+            padded_putdUart0(taskInfo[i].stackPeak, 9);
+            padded_putdUart0(taskInfo[i].quantum, 11);
             putsUart0("|\n");
         }
     }
-    putsUart0("|-----------------------------------------------------------------------------------|\n\n");
+    putsUart0("|-----------------------------------------------------------------------------------------------------------------------------|\n\n");
 }
 
 void ipcs() {
     ipcsInfo info[1] = {0};
     __asm(" SVC #0x0B");
     uint32_t i, j;
-    putsUart0("|---Mutex---|--Locked--|-LockedBy-|-Queue Size-|-----Queue-----|\n");
+    putsUart0("|---Mutex---|--Ceiling--|--Locked--|-LockedBy-|-Queue Size-|-----Queue-----|\n");
     for (i = 0; i < MAX_MUTEXES; i++) {
         putsUart0("|");
         padded_putdUart0(i, 12);
+        if (info->mutexes[i].ceiling != NO_CEILING) {
+            padded_putdUart0(info->mutexes[i].ceiling, 12);
+        }
+        else {
+            padded_putsUart0("-", 12);
+        }
         if (info->mutexes[i].lock) {
             padded_putsUart0("yes", 11);
             padded_putsUart0(info->nameArr[info->mutexes[i].lockedBy], 11);
-            padded_putdUart0(info->mutexes[i].queueSize, 13);
-            if (info->mutexes[i].queueSize > 0) {
-                for (j = 0; j < info->mutexes[i].queueSize; j++) {
+            padded_putdUart0(info->mutexes[i].waiters.size, 13);
+            if (info->mutexes[i].waiters.size > 0) {
+                for (j = 0; j < info->mutexes[i].waiters.size; j++) {
                     //fput1dUart0("\t%d - ", j);
-                    fput1sUart0("%s", info->nameArr[info->mutexes[i].processQueue[j]]); //print names
-                    if (j != info->mutexes[i].queueSize-1) {
+                    fput1sUart0("%s", info->nameArr[info->mutexWaiters[i][j]]); //print names
+                    if (j != info->mutexes[i].waiters.size-1) {
                         putsUart0("->");
                     }
                 }
@@ -87,19 +130,19 @@ void ipcs() {
         }
         putsUart0("\n");
     }
-    putsUart0("|--------------------------------------------------------------|\n\n");
+    putsUart0("|--------------------------------------------------------------------------|\n\n");
 
     putsUart0("|---Semaphore---|--Count--|----Queue Size----|------Queue------|\n");
     for (i = 0; i < MAX_SEMAPHORES; i++) {
         putsUart0("|");
         padded_putdUart0(i, 16);
         padded_putdUart0(info->semaphores[i].count, 11);
-        padded_putdUart0(info->semaphores[i].queueSize, 18);
-        if (info->semaphores[i].queueSize > 0) {
-            for (j = 0; j < info->semaphores[i].queueSize; j++) {
+        padded_putdUart0(info->semaphores[i].waiters.size, 18);
+        if (info->semaphores[i].waiters.size > 0) {
+            for (j = 0; j < info->semaphores[i].waiters.size; j++) {
                 //fput1dUart0("\t%d - ", j);
-                fput1sUart0("%s", info->nameArr[info->semaphores[i].processQueue[j]]); //print names
-                if (j != info->semaphores[i].queueSize-1) {
+                fput1sUart0("%s", info->nameArr[info->semaphoreWaiters[i][j]]); //print names
+                if (j != info->semaphores[i].waiters.size-1) {
                     putsUart0("->");
                 }
             }
@@ -107,6 +150,81 @@ void ipcs() {
         putsUart0("\n");
     }
     putsUart0("|--------------------------------------------------------------|\n\n");
+
+    putsUart0("|---Queue---|--Messages--|----Queue Size----|------Queue------|\n");
+    for (i = 0; i < MAX_QUEUES; i++) {
+        putsUart0("|");
+        padded_putdUart0(i, 12);
+        padded_putdUart0(info->queueCount[i], 14);
+        padded_putdUart0(info->queueSize[i], 18);
+        for (j = 0; j < info->queueSize[i]; j++) {
+            fput1sUart0("%s", info->nameArr[info->queueWaiters[i][j]]); //senders if full, receivers if empty
+            if (j != info->queueSize[i]-1) {
+                putsUart0("->");
+            }
+        }
+        putsUart0("\n");
+    }
+    putsUart0("|--------------------------------------------------------------|\n\n");
+
+    putsUart0("|---Event---|-----Flags-----|----Queue Size----|------Queue------|\n");
+    for (i = 0; i < MAX_EVENTS; i++) {
+        putsUart0("|");
+        padded_putdUart0(i, 12);
+        putsUart0("0x");
+        padded_puthUart0(info->events[i].flags, 14);
+        padded_putdUart0(info->events[i].waiters.size, 18);
+        for (j = 0; j < info->events[i].waiters.size; j++) {
+            fput1sUart0("%s", info->nameArr[info->eventWaiters[i][j]]);
+            if (j != info->events[i].waiters.size-1) {
+                putsUart0("->");
+            }
+        }
+        putsUart0("\n");
+    }
+    putsUart0("|--------------------------------------------------------------|\n\n");
+
+    putsUart0("|--RwLock--|--Readers--|--Writer--|----Queue Size----|------Queue------|\n");
+    for (i = 0; i < MAX_RWLOCKS; i++) {
+        putsUart0("|");
+        padded_putdUart0(i, 11);
+        padded_putdUart0(info->rwLocks[i].readers, 12);
+        if (info->rwLocks[i].writer != INVALID_TASK) {
+            padded_putsUart0(info->nameArr[info->rwLocks[i].writer], 11);
+        }
+        else {
+            padded_putsUart0("-", 11);
+        }
+        padded_putdUart0(info->rwLocks[i].writeWaiters.size + info->rwLocks[i].readWaiters.size, 18);
+        //writers are granted first
+        for (j = 0; j < info->rwLocks[i].writeWaiters.size; j++) {
+            fput1sUart0("W:%s ", info->nameArr[info->rwWriteWaiters[i][j]]);
+        }
+        for (j = 0; j < info->rwLocks[i].readWaiters.size; j++) {
+            fput1sUart0("R:%s ", info->nameArr[info->rwReadWaiters[i][j]]);
+        }
+        putsUart0("\n");
+        for (j = 0; j < info->rwLocks[i].readers; j++) {
+            fput1sUart0("|   reading: %s\n", info->nameArr[info->rwReaders[i][j]]);
+        }
+    }
+    putsUart0("|----------------------------------------------------------------------|\n\n");
+
+    putsUart0("|---Cond---|----Queue Size----|------Queue (mutex)------|\n");
+    for (i = 0; i < MAX_CONDS; i++) {
+        putsUart0("|");
+        padded_putdUart0(i, 11);
+        padded_putdUart0(info->conds[i].waiters.size, 18);
+        for (j = 0; j < info->conds[i].waiters.size; j++) {
+            fput1sUart0("%s", info->nameArr[info->condWaiters[i][j]]);
+            fput1dUart0("(%d)", info->condMutex[i][j]);
+            if (j != info->conds[i].waiters.size-1) {
+                putsUart0("->");
+            }
+        }
+        putsUart0("\n");
+    }
+    putsUart0("|--------------------------------------------------------|\n\n");
 }
 
 void kill(uint32_t pid) {
@@ -135,9 +253,9 @@ void pkill(const char name[]) {
     }
 }
 
-void sched(uint8_t prio_on) {
+void sched(uint8_t mode) {
     __asm(" SVC #0x07");
-    fput1sUart0("sched %s\n", prio_on ? "prio" : "rr");
+    fput1sUart0("sched %s\n", mode == SCHED_EDF ? "edf" : (mode == SCHED_PRIO ? "prio" : "rr"));
 }
 
 void pi(uint8_t on) {
@@ -150,6 +268,23 @@ void preempt(uint8_t on) {
     fput1sUart0("preempt %s\n", on ? "on" : "off");
 }
 
+void tickless(uint8_t on) {
+    __asm(" SVC #0x14");
+    fput1sUart0("tickless %s\n", on ? "on" : "off");
+}
+
+void quantum(const char name[], uint32_t ticks) {
+    uint32_t pid = pidof(name);
+    if (pid > 0 && ticks > 0) {
+        setThreadPriority((_fn)pid, KEEP_PRIORITY, ticks);
+        fput1sUart0("%s quantum ", name);
+        fput1dUart0("%d ticks\n", ticks);
+    }
+    else {
+        putsUart0("Invalid process or quantum\n");
+    }
+}
+
 uint32_t pidof(const char name[]) {
     __asm(" SVC #0x0C");
     uint32_t pid = getR0();
@@ -158,27 +293,158 @@ uint32_t pidof(const char name[]) {
 }
 
 void meminfo() {
-    memInfo info[MAX_ALLOCS] = {};
+    memInfo info[1] = {0};
     __asm(" SVC #0x0D");
     uint32_t i;
-    putsUart0("|---Alloc---|---Thread---|---Address---|---Size---|---Usage---|\n");
+    uint32_t guards = 0;
+    putsUart0("|---Alloc---|---Thread---|---Address---|---Size---|-Stack Peak-|--Guard--|\n");
     for (i = 0; i < MAX_ALLOCS; i++) { //i dont have access to n_allocs idiot
-        if (info[i].valid) {
+        if (info->allocs[i].valid) {
             putsUart0("|");
             padded_putdUart0(i, 12);
-            padded_putsUart0(info[i].ownerName, 13);
+            padded_putsUart0(info->allocs[i].ownerName, 13);
             putsUart0("0x");
-            padded_puthUart0((uint32_t)info[i].baseAdd, 12);
-            padded_putdUart0(info[i].size, 11);
-            fput1dUart0("%d.", info[i].usage / 10);
-            fput1dUart0("%d%", info[i].usage % 10);
-            padded_putsUart0(" ", info[i].usage/10 < 10 ? 7 : 6);
+            padded_puthUart0((uint32_t)info->allocs[i].baseAdd, 12);
+            padded_putdUart0(info->allocs[i].size, 11);
+            if (info->allocs[i].stack) {
+                fput1dUart0("%d.", info->allocs[i].usage / 10);
+                fput1dUart0("%d%", info->allocs[i].usage % 10);
+                padded_putsUart0(" ", info->allocs[i].usage/10 < 10 ? 8 : (info->allocs[i].usage/10 < 100 ? 7 : 6));
+            }
+            else {
+                padded_putsUart0("-", 12);
+            }
+            padded_putdUart0(info->allocs[i].guard, 9);
             putsUart0("|\n");
+            guards += info->allocs[i].guard;
         }
         //whole = value / 10
         //decimal = value % 10
     }
-    putsUart0("|-------------------------------------------------------------|\n\n");
+    putsUart0("|------------------------------------------------------------------------|\n");
+    fput1dUart0("Stack guards: %d B\n\n", guards);
+
+    putsUart0("|---Pool---|---Thread---|---Address---|--Block--|--Used--|--Peak--|\n");
+    for (i = 0; i < MAX_POOLS; i++) {
+        if (info->pools[i].valid) {
+            putsUart0("|");
+            padded_putdUart0(i, 11);
+            padded_putsUart0(info->pools[i].ownerName, 13);
+            putsUart0("0x");
+            padded_puthUart0((uint32_t)info->pools[i].baseAdd, 12);
+            padded_putdUart0(info->pools[i].blockSize, 10);
+            fput1dUart0("%d/", info->pools[i].used);
+            padded_putdUart0(info->pools[i].blocks, 6);
+            padded_putdUart0(info->pools[i].peak, 8);
+            putsUart0("|\n");
+        }
+    }
+    putsUart0("|-----------------------------------------------------------------|\n\n");
+
+    putsUart0("|---Thread---|--Quota--|--Used--|--Peak--|\n");
+    for (i = 0; i < MAX_TASKS; i++) {
+        if (info->quotas[i].valid) {
+            putsUart0("|");
+            padded_putsUart0(info->quotas[i].name, 13);
+            if (info->quotas[i].quota != NO_HEAP_QUOTA) {
+                padded_putdUart0(info->quotas[i].quota, 10);
+            }
+            else {
+                padded_putsUart0("-", 10);
+            }
+            padded_putdUart0(info->quotas[i].used, 9);
+            padded_putdUart0(info->quotas[i].peak, 8);
+            putsUart0("|\n");
+        }
+    }
+    putsUart0("|----------------------------------------|\n\n");
+}
+
+void bench(uint8_t n) {
+    benchInfo info = {0};
+    uint32_t i;
+    _fn pong;
+    if (n == BENCH_PI) {
+        //worst-case mutex blocking with the current task set, pi off then on
+        runBench(&info, BENCH_BLOCKING_RESET);
+        pi(false);
+        sleep(BENCH_PI_WINDOW);
+        pi(true);
+        sleep(BENCH_PI_WINDOW);
+        runBench(&info, BENCH_BLOCKING);
+    }
+    else if (n == BENCH_PINGPONG) {
+        //round trip to the pong task through the semaphore queues, then through notifications
+        //both run alone above the demo tasks, so each round trip is just the two switches
+        runBench(&info, BENCH_EXCLUSIVE);
+        runBench(&info, BENCH_PONG);
+        if (!info.after[0]) {
+            runBench(&info, BENCH_EXCLUSIVE_END);
+            putsUart0("no task slot or stack for the pong task\n\n");
+            return;
+        }
+        pong = (_fn)pidof("Pong");
+        runBench(&info, BENCH_LAP);
+        for (i = 0; i < BENCH_ROUND_TRIPS; i++) {
+            post(benchPing);
+            wait(benchPong);
+        }
+        runBench(&info, BENCH_LAP);
+        info.before[0] = info.after[0] / BENCH_ROUND_TRIPS;
+        for (i = 0; i < BENCH_ROUND_TRIPS; i++) {
+            notify(pong, (uint32_t)shell, NOTIFY_OVERWRITE); //the pid to answer
+            notifyWait(0xFFFFFFFF, WAIT_FOREVER);
+        }
+        runBench(&info, BENCH_LAP);
+        runBench(&info, BENCH_EXCLUSIVE_END);
+        info.after[0] /= BENCH_ROUND_TRIPS;
+        str_copy(info.label[0], "round trip");
+        str_copy(info.unit, "cycles");
+        info.rows = 1;
+    }
+    else if (n == BENCH_MUTEX) {
+        //uncontended lock/unlock pair through the svc mutex, then through the fast mutex
+        //the shell runs above its peers so neither loop is preempted by them
+        runBench(&info, BENCH_EXCLUSIVE);
+        runBench(&info, BENCH_LAP);
+        for (i = 0; i < BENCH_ROUND_TRIPS; i++) {
+            lock(benchMutex);
+            unlock(benchMutex);
+        }
+        runBench(&info, BENCH_LAP);
+        info.before[0] = info.after[0] / BENCH_ROUND_TRIPS;
+        runBench(&info, BENCH_LAP);
+        for (i = 0; i < BENCH_ROUND_TRIPS; i++) {
+            fastLock(benchFast);
+            fastUnlock(benchFast);
+        }
+        runBench(&info, BENCH_LAP);
+        runBench(&info, BENCH_EXCLUSIVE_END);
+        info.after[0] /= BENCH_ROUND_TRIPS;
+        str_copy(info.label[0], "lock+unlock");
+        str_copy(info.unit, "cycles");
+        info.rows = 1;
+    }
+    else {
+        runBench(&info, n);
+    }
+    fput1sUart0("|-----Case-----|---Before (%s)", info.unit);
+    fput1sUart0("---|---After (%s)---|\n", info.unit);
+    for (i = 0; i < info.rows; i++) {
+        putsUart0("|");
+        padded_putsUart0(info.label[i], 15);
+        padded_putdUart0(info.before[i], 20);
+        padded_putdUart0(info.after[i], 19);
+        putsUart0("|\n");
+    }
+    putsUart0("|-------------------------------------------------------|\n\n");
+    if (n == BENCH_CONTEXT) {
+        for (i = 0; i < info.rows; i++) {
+            if (info.after[i] > info.before[i]) {
+                fput1sUart0("WARNING: %s over budget\n\n", info.label[i]);
+            }
+        }
+    }
 }
 
 void reboot() {
@@ -188,7 +454,8 @@ void reboot() {
 void shell() {
     USER_DATA data;
     uint8_t pre = 1;
-    uint8_t prio = 1;
+    uint8_t prio = SCHED_PRIO;
+    uint8_t tl = 0;
     putsUart0(">");
     while (1) {
         if (kbhitUart0()) {
@@ -212,6 +479,39 @@ void shell() {
                 valid = true;
                 meminfo();
             }
+            if (isCommand(&data, "quantum", 2)) { //quantum proc_name ticks
+                valid = true;
+                char* name = getFieldString(&data, 1);
+                quantum(name, getFieldInteger(&data, 2));
+            }
+            if (isCommand(&data, "bench", 1)) { //bench SCHED|PI|SWITCH|CTX|RING|NOTIFY|MUTEX|HEAP
+                valid = true;
+                char* name = getFieldString(&data, 1);
+                if (str_equal(name, "SCHED")) {
+                    bench(BENCH_SCHED);
+                }
+                else if (str_equal(name, "PI")) {
+                    bench(BENCH_PI);
+                }
+                else if (str_equal(name, "SWITCH")) {
+                    bench(BENCH_SWITCHES);
+                }
+                else if (str_equal(name, "CTX")) {
+                    bench(BENCH_CONTEXT);
+                }
+                else if (str_equal(name, "RING")) {
+                    bench(BENCH_RING);
+                }
+                else if (str_equal(name, "NOTIFY")) {
+                    bench(BENCH_PINGPONG);
+                }
+                else if (str_equal(name, "MUTEX")) {
+                    bench(BENCH_MUTEX);
+                }
+                else if (str_equal(name, "HEAP")) {
+                    bench(BENCH_HEAP);
+                }
+            }
             if (isCommand(&data, "kill", 1)) { //kill pid
                 valid = true;
                 uint32_t pid = getFieldHexInteger(&data, 1);
@@ -222,7 +522,7 @@ void shell() {
                 char* str = getFieldString(&data, 1);
                 pkill(str);
             }
-            /*if (isCommand(&data, "pi", 1)) { //pi ON|OFF
+            if (isCommand(&data, "pi", 1)) { //pi ON|OFF
                 valid = true;
                 char* stat = getFieldString(&data, 1);
                 if (str_equal(stat, "ON")) {
@@ -231,7 +531,7 @@ void shell() {
                 else if (str_equal(stat, "OFF")) {
                     pi(false);
                 }
-            }*/
+            }
             if (isCommand(&data, "preempt", 0)) {
                     valid = true;
                     fput1sUart0("Preemption: %s\n", pre ? "On" : "Off");
@@ -248,20 +548,40 @@ void shell() {
                     pre = 0;
                 }
             }
+            if (isCommand(&data, "tickless", 0)) {
+                valid = true;
+                fput1sUart0("Tickless: %s\n", tl ? "On" : "Off");
+            }
+            if (isCommand(&data, "tickless", 1)) { //tickless ON|OFF
+                valid = true;
+                char* stat = getFieldString(&data, 1);
+                if (str_equal(stat, "ON")) {
+                    tickless(true);
+                    tl = 1;
+                }
+                else if (str_equal(stat, "OFF")) {
+                    tickless(false);
+                    tl = 0;
+                }
+            }
             if (isCommand(&data, "sched", 0)) {
                 valid = true;
-                fput1sUart0("Scheduler Mode: %s\n", prio ? "priority" : "round-robin");
+                fput1sUart0("Scheduler Mode: %s\n", prio == SCHED_EDF ? "earliest-deadline-first" : (prio == SCHED_PRIO ? "priority" : "round-robin"));
             }
-            if (isCommand(&data, "sched", 1)) { //sched PRIO|RR
+            if (isCommand(&data, "sched", 1)) { //sched PRIO|RR|EDF
                 valid = true;
                 char* stat = getFieldString(&data, 1);
                 if (str_equal(stat, "PRIO")) {
-                    sched(1);
-                    prio = 1;
+                    sched(SCHED_PRIO);
+                    prio = SCHED_PRIO;
                 }
                 else if (str_equal(stat, "RR")) {
-                    sched(0);
-                    prio = 0;
+                    sched(SCHED_RR);
+                    prio = SCHED_RR;
+                }
+                else if (str_equal(stat, "EDF")) {
+                    sched(SCHED_EDF);
+                    prio = SCHED_EDF;
                 }
             }
             if (isCommand(&data, "pidof", 1)) { //pidof proc_name
@@ -23,6 +23,7 @@
 #include "mm.h"
 #include "tasks.h"
 #include "nvic.h"
+#include "shell.h"
 
 
 //-----------------------------------------------------------------------------
@@ -167,9 +168,15 @@ void lengthyFn(void)
 {
     uint16_t i;
     uint8_t* mem;
-    mem = malloc_from_heap(5000 * sizeof(uint8_t));
     while(true)
     {
+        //buffer is only held for one pass so the heap can be reused between passes
+        mem = malloc_from_heap(5000 * sizeof(uint8_t));
+        if (!mem)
+        {
+            yield();
+            continue;
+        }
         lock(resource);
         for (i = 0; i < 5000; i++)
         {
@@ -178,6 +185,7 @@ void lengthyFn(void)
         }
         setPinValue(RED_LED, !getPinValue(RED_LED));
         unlock(resource);
+        free_from_heap(mem);
     }
 }
 
@@ -186,14 +194,14 @@ void readKeys(void)
     uint8_t buttons;
     while(true)
     {
-        wait(keyReleased);
+        waitEvents(keyEvents, KEY_RELEASED, EVENT_ANY | EVENT_CLEAR, WAIT_FOREVER);
         buttons = 0;
         while (buttons == 0)
         {
             buttons = readPbs();
             yield();
         }
-        post(keyPressed);
+        setEvents(keyEvents, KEY_PRESSED);
         if ((buttons & 1) != 0)
         {
             setPinValue(YELLOW_LED, !getPinValue(YELLOW_LED));
@@ -214,7 +222,7 @@ void readKeys(void)
         }
         if ((buttons & 16) != 0)
         {
-            setThreadPriority(lengthyFn, 4);
+            setThreadPriority(lengthyFn, 4, 0);
         }
         yield();
     }
@@ -225,7 +233,7 @@ void debounce(void)
     uint8_t count;
     while(true)
     {
-        wait(keyPressed);
+        waitEvents(keyEvents, KEY_PRESSED, EVENT_ANY | EVENT_CLEAR, WAIT_FOREVER);
         count = 10;
         while (count != 0)
         {
@@ -235,7 +243,7 @@ void debounce(void)
             else
                 count = 10; //if button is pressed
         }
-        post(keyReleased);
+        setEvents(keyEvents, KEY_RELEASED);
     }
 }
 
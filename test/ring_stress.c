@@ -0,0 +1,127 @@
+// Ring Buffer Host Stress Test
+// Giancarlo Perez
+
+//-----------------------------------------------------------------------------
+// Hardware Target
+//-----------------------------------------------------------------------------
+
+// Target Platform: host (Linux, gcc, pthreads), not the TM4C123GH6PM
+// System Clock:    -
+
+// Runs libs/ring.c with a producer and a consumer thread. The DMB barriers are
+// stubbed with a full compiler and cpu barrier. From the repo root:
+//   gcc -O2 -pthread -Iinclude '-D__asm(x)=__sync_synchronize()' test/ring_stress.c libs/ring.c -o ring_stress
+//   ./ring_stress
+// Exits 0 and prints PASS if every byte came out once and in order.
+
+//-----------------------------------------------------------------------------
+// Device includes, defines, and assembler directives
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <sched.h>
+#include "ring.h"
+
+#define RING_SIZE    64
+#define TOTAL_BYTES  (16u * 1024 * 1024)
+#define START_INDEX  0xFFFFF000u  // head and tail wrap past 2^32 early in the run
+#define MAX_CHUNK    29           // not a divisor of RING_SIZE, so chunks straddle the end of data[]
+
+//-----------------------------------------------------------------------------
+// Global variables
+//-----------------------------------------------------------------------------
+
+uint8_t data[RING_SIZE];
+ringBuffer ring;
+uint32_t errors = 0;
+uint32_t firstError = 0;
+
+//-----------------------------------------------------------------------------
+// Subroutines
+//-----------------------------------------------------------------------------
+
+// both sides generate the same stream, so a lost, repeated or reordered byte breaks the match
+static uint8_t nextByte(uint32_t* state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+static void* producer(void* arg)
+{
+    uint8_t chunk[MAX_CHUNK];
+    uint32_t state = 0x12345678;
+    uint32_t sent = 0;
+    uint32_t n, put, i;
+    uint32_t size = 1;
+    (void)arg;
+    while (sent < TOTAL_BYTES)
+    {
+        n = size;
+        if (n > TOTAL_BYTES - sent)
+            n = TOTAL_BYTES - sent;
+        for (i = 0; i < n; i++)
+            chunk[i] = nextByte(&state);
+        i = 0;
+        while (i < n)
+        {
+            put = ringPut(&ring, chunk + i, n - i);
+            if (put == 0)
+                sched_yield();    // full, on a single core host the consumer has to run
+            i += put;
+        }
+        sent += n;
+        size = (size % MAX_CHUNK) + 1;
+    }
+    return NULL;
+}
+
+static void* consumer(void* arg)
+{
+    uint8_t chunk[MAX_CHUNK];
+    uint32_t state = 0x12345678;
+    uint32_t received = 0;
+    uint32_t n, i;
+    uint32_t size = MAX_CHUNK;
+    (void)arg;
+    while (received < TOTAL_BYTES)
+    {
+        n = ringGet(&ring, chunk, size);
+        if (n == 0)
+            sched_yield();
+        for (i = 0; i < n; i++)
+        {
+            if (chunk[i] != nextByte(&state) && errors++ == 0)
+                firstError = received + i;
+        }
+        received += n;
+        size = (size == 1) ? MAX_CHUNK : size - 1;
+    }
+    if (ringCount(&ring) != 0)
+        errors++;
+    return NULL;
+}
+
+int main(void)
+{
+    pthread_t p, c;
+    initRing(&ring, data, RING_SIZE);
+    ring.head = START_INDEX;
+    ring.tail = START_INDEX;
+    pthread_create(&c, NULL, consumer, NULL);
+    pthread_create(&p, NULL, producer, NULL);
+    pthread_join(p, NULL);
+    pthread_join(c, NULL);
+    if (errors != 0)
+    {
+        printf("FAIL: %u bad bytes, first at byte %u\n", errors, firstError);
+        return 1;
+    }
+    printf("PASS: %u bytes through a %u byte ring, indexes wrapped at 2^32\n", TOTAL_BYTES, RING_SIZE);
+    return 0;
+}